@@ -0,0 +1,354 @@
+// Codec benchmark over deterministic synthetic corpora. For every codec,
+// corpus and size it times compress and decompress (median and MAD of the
+// repetitions after one warmup run), checks the round trip, and reports
+// MB/s, ratio (input / output, higher is smaller), cycles per byte, peak
+// heap use and steady-state allocations per call, as a table and
+// optionally as JSON. --require-zero-alloc fails the run if a warmed-up
+// codec still allocates.
+//
+// With --compare it also acts as a regression gate: the run is checked
+// against a saved JSON baseline, rows that look slower are re-measured, and
+// the exit status is 2 if a regression remains. A baseline from another
+// level, or one whose rows differ from this run's, also exits with 2.
+//
+//   g++ -std=c++17 -O2 -pthread bench/bench.cpp -o bench
+//   ./bench --json baseline.json
+//   ./bench --compare baseline.json
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "../argparse/argparse.hpp"
+#include "../include/allocation_hook.hpp"
+#include "../include/level.hpp"
+#include "../include/pipeline.hpp"
+#include "corpus.hpp"
+#include "results.hpp"
+
+// Time stamp counter ticks: constant-rate reference cycles, not core clock
+// cycles, but stable enough to compare builds on one machine.
+uint64_t cycleCount() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct Measurement {
+    double mbps = 0.0;
+    double mbps_mad = 0.0;
+    double cycles_per_byte = 0.0;
+    size_t peak_bytes = 0;
+    double allocations_per_call = 0.0;
+};
+
+// Runs `fn` once to warm up, then `repetitions` times over `bytes` of
+// input. Keeps the median throughput and its MAD, the median cycles per
+// byte, the heap high-water mark above what was live before the runs, and
+// the allocations per call once warm.
+template <typename Fn>
+Measurement measure(size_t bytes, int repetitions, Fn fn) {
+    AllocationScope heap;
+    fn();
+
+    std::vector<double> mbps;
+    std::vector<double> cycles;
+    mbps.reserve(repetitions);
+    cycles.reserve(repetitions);
+    AllocationScope warm;
+    for (int i = 0; i < repetitions; i++) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t start_cycles = cycleCount();
+        fn();
+        uint64_t elapsed_cycles = cycleCount() - start_cycles;
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        mbps.push_back(elapsed.count() > 0 ? bytes / 1e6 / elapsed.count() : 0.0);
+        cycles.push_back(bytes > 0 ? static_cast<double>(elapsed_cycles) / bytes : 0.0);
+    }
+
+    Measurement result;
+    result.allocations_per_call = static_cast<double>(warm.allocations()) / repetitions;
+    result.mbps = Statistics::median(mbps);
+    result.mbps_mad = Statistics::mad(mbps);
+    result.cycles_per_byte = Statistics::median(cycles);
+    result.peak_bytes = heap.peakBytes();
+    return result;
+}
+
+// With `require_zero_allocations`, one more encode and decode after the
+// timed runs must not touch the heap.
+BenchResult run(const std::string& codec, const CompressionLevel& level, const Corpus& corpus, int repetitions,
+                bool require_zero_allocations = false) {
+    Pipeline pipeline(level.configure(Pipeline::parseSpecs(codec)));
+    std::vector<uint8_t> encoded, decoded, scratch;
+    size_t size = corpus.data.size();
+
+    Measurement compress = measure(size, repetitions, [&] { pipeline.encodeBlock(corpus.data, encoded, scratch); });
+    Measurement decompress = measure(size, repetitions, [&] { pipeline.decodeBlock(encoded, decoded, scratch); });
+    if (require_zero_allocations) {
+        AllocationScope::requireNone(codec + " on " + corpus.name, [&] {
+            pipeline.encodeBlock(corpus.data, encoded, scratch);
+            pipeline.decodeBlock(encoded, decoded, scratch);
+        });
+    }
+
+    BenchResult result;
+    result.codec = codec;
+    std::replace(result.codec.begin(), result.codec.end(), ',', '+');
+    result.corpus = corpus.name;
+    result.size = size;
+    result.compressed_size = encoded.size();
+    result.ratio = encoded.empty() ? 0.0 : static_cast<double>(size) / encoded.size();
+    result.compress_mbps = compress.mbps;
+    result.compress_mbps_mad = compress.mbps_mad;
+    result.decompress_mbps = decompress.mbps;
+    result.decompress_mbps_mad = decompress.mbps_mad;
+    result.compress_cycles_per_byte = compress.cycles_per_byte;
+    result.decompress_cycles_per_byte = decompress.cycles_per_byte;
+    result.compress_peak_bytes = compress.peak_bytes;
+    result.decompress_peak_bytes = decompress.peak_bytes;
+    result.compress_allocations_per_call = compress.allocations_per_call;
+    result.decompress_allocations_per_call = decompress.allocations_per_call;
+    result.round_trip = decoded == corpus.data;
+    return result;
+}
+
+// Keeps the faster of two measurements of the same row, per direction.
+void keepFaster(BenchResult& kept, const BenchResult& rerun) {
+    if (rerun.compress_mbps > kept.compress_mbps) {
+        kept.compress_mbps = rerun.compress_mbps;
+        kept.compress_mbps_mad = rerun.compress_mbps_mad;
+        kept.compress_cycles_per_byte = rerun.compress_cycles_per_byte;
+    }
+    if (rerun.decompress_mbps > kept.decompress_mbps) {
+        kept.decompress_mbps = rerun.decompress_mbps;
+        kept.decompress_mbps_mad = rerun.decompress_mbps_mad;
+        kept.decompress_cycles_per_byte = rerun.decompress_cycles_per_byte;
+    }
+}
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+void printTable(const std::vector<BenchResult>& results) {
+    std::cout << std::left << std::setw(13) << "codec" << std::setw(9) << "corpus" << std::right << std::setw(10)
+              << "size" << std::setw(8) << "ratio" << std::setw(10) << "comp MB/s" << std::setw(10) << "dec MB/s"
+              << std::setw(9) << "comp c/B" << std::setw(9) << "dec c/B" << std::setw(11) << "peak KiB"
+              << std::setw(13) << "allocs/call" << std::setw(6) << "ok" << "\n";
+    for (const BenchResult& r : results) {
+        uint64_t peak = std::max(r.compress_peak_bytes, r.decompress_peak_bytes);
+        std::cout << std::left << std::setw(13) << r.codec << std::setw(9) << r.corpus << std::right
+                  << std::setw(10) << r.size << std::fixed << std::setprecision(3) << std::setw(8) << r.ratio
+                  << std::setprecision(1) << std::setw(10) << r.compress_mbps << std::setw(10) << r.decompress_mbps
+                  << std::setw(9) << r.compress_cycles_per_byte << std::setw(9) << r.decompress_cycles_per_byte
+                  << std::setw(11) << peak / 1024 << std::setw(13) << std::setprecision(0)
+                  << r.compress_allocations_per_call + r.decompress_allocations_per_call << std::setw(6)
+                  << (r.round_trip ? "yes" : "NO") << "\n";
+    }
+}
+
+// Prints the regressions and returns how many there were.
+size_t reportRegressions(std::ostream& out, const std::vector<RegressionGate::Finding>& findings) {
+    size_t regressions = 0;
+    for (const auto& finding : findings) {
+        if (!finding.regression) {
+            continue;
+        }
+        if (regressions++ == 0) {
+            out << "\nRegressions:\n";
+        }
+        double change = finding.baseline > 0 ? 100.0 * (finding.current / finding.baseline - 1.0) : 0.0;
+        out << "  " << std::left << std::setw(30) << finding.key << std::setw(17) << finding.metric
+                  << std::right << std::fixed << std::setprecision(2) << std::setw(10) << finding.baseline
+                  << " -> " << std::setw(10) << finding.current << std::setprecision(1) << std::setw(8) << change
+                  << "%\n";
+    }
+    out << "\n" << regressions << " regression(s) in " << findings.size() << " comparisons\n";
+    return regressions;
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser program("bench", "1.0");
+
+    program.add_argument("--codecs")
+        .help("comma-separated codecs or chains joined with '+', e.g. rle,lzw+huffman")
+        .default_value(std::string("rle,huffman,lzw,bwt"));
+
+    program.add_argument("--corpora")
+        .help("comma-separated corpora: random, text, runs, binary, records")
+        .default_value(std::string("random,text,runs,binary,records"));
+
+    program.add_argument("--sizes")
+        .help("comma-separated corpus sizes in bytes")
+        .default_value(std::string("65536,1048576"));
+
+    program.add_argument("-l", "--level")
+        .help("compression level whose codec settings are used")
+        .default_value(CompressionLevel::DEFAULT)
+        .scan<'i', int>();
+
+    program.add_argument("-r", "--repetitions")
+        .help("timed runs per measurement, after one warmup run")
+        .default_value(5)
+        .scan<'i', int>();
+
+    program.add_argument("--json")
+        .help("also write the results as JSON to this file ('-' for stdout)");
+
+    program.add_argument("--require-zero-alloc")
+        .help("comma-separated codecs whose warmed-up encode and decode must not allocate")
+        .default_value(std::string(""));
+
+    program.add_argument("--compare")
+        .help("baseline JSON from an earlier run; exit with status 2 on a regression");
+
+    program.add_argument("--confirm")
+        .help("re-run rows that look slower than the baseline up to this many times before reporting them")
+        .default_value(2)
+        .scan<'i', int>();
+
+    program.add_argument("--throughput-tolerance")
+        .help("allowed relative MB/s drop before it counts as a regression")
+        .default_value(0.10)
+        .scan<'g', double>();
+
+    program.add_argument("--ratio-tolerance")
+        .help("allowed relative ratio drop before it counts as a regression")
+        .default_value(0.005)
+        .scan<'g', double>();
+
+    program.add_argument("--noise-mads")
+        .help("a MB/s drop must also exceed this many MADs (as standard deviations) of noise")
+        .default_value(3.0)
+        .scan<'g', double>();
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << "\n";
+        std::cerr << program;
+        return 1;
+    }
+
+    try {
+        BenchRun current;
+        current.level = program.get<int>("level");
+        current.repetitions = program.get<int>("repetitions");
+        CompressionLevel level = CompressionLevel::get(current.level);
+        if (current.repetitions < 1) {
+            throw std::runtime_error("Repetitions must be at least 1");
+        }
+
+        RegressionTolerances tolerances;
+        tolerances.throughput = program.get<double>("throughput-tolerance");
+        tolerances.ratio = program.get<double>("ratio-tolerance");
+        tolerances.noise_mads = program.get<double>("noise-mads");
+
+        BenchRun baseline;
+        auto compare = program.present<std::string>("--compare");
+        if (compare) {
+            std::ifstream in(*compare);
+            if (!in) {
+                throw std::runtime_error("Cannot open file: " + *compare);
+            }
+            baseline = ResultsFile::read(in);
+            if (baseline.level != current.level) {
+                std::cerr << "Error: baseline was recorded at level " << baseline.level << ", not "
+                          << current.level << "\n";
+                return 2;
+            }
+        }
+
+        std::vector<std::string> zero_allocation = splitList(program.get<std::string>("require-zero-alloc"));
+        for (const std::string& size : splitList(program.get<std::string>("sizes"))) {
+            for (const std::string& name : splitList(program.get<std::string>("corpora"))) {
+                Corpus corpus = CorpusGenerator::make(name, std::stoul(size));
+                for (std::string codec : splitList(program.get<std::string>("codecs"))) {
+                    bool require_zero = std::find(zero_allocation.begin(), zero_allocation.end(), codec) !=
+                                        zero_allocation.end();
+                    std::replace(codec.begin(), codec.end(), '+', ',');
+                    current.results.push_back(run(codec, level, corpus, current.repetitions, require_zero));
+                }
+            }
+        }
+
+        // A row that looks slower is measured again, keeping its best
+        // result, so one unlucky scheduling burst does not fail the gate.
+        if (compare) {
+            for (int attempt = 0; attempt < program.get<int>("confirm"); attempt++) {
+                std::set<std::string> suspects;
+                for (const auto& finding : RegressionGate::compare(baseline, current, tolerances)) {
+                    if (finding.regression && finding.metric != "ratio") {
+                        suspects.insert(finding.key);
+                    }
+                }
+                for (BenchResult& r : current.results) {
+                    if (suspects.count(r.key())) {
+                        std::string codec = r.codec;
+                        std::replace(codec.begin(), codec.end(), '+', ',');
+                        Corpus corpus = CorpusGenerator::make(r.corpus, r.size);
+                        keepFaster(r, run(codec, level, corpus, current.repetitions));
+                    }
+                }
+            }
+        }
+
+        bool ok = std::all_of(current.results.begin(), current.results.end(),
+                              [](const BenchResult& r) { return r.round_trip; });
+        auto json = program.present<std::string>("--json");
+        if (json && *json == "-") {
+            ResultsFile::write(std::cout, current);
+        } else {
+            if (json) {
+                std::ofstream out(*json);
+                if (!out) {
+                    throw std::runtime_error("Cannot write to file: " + *json);
+                }
+                ResultsFile::write(out, current);
+            }
+            printTable(current.results);
+        }
+        if (!ok) {
+            std::cerr << "Error: round trip mismatch\n";
+            return 1;
+        }
+
+        if (compare) {
+            // Keep stdout pure JSON when that is where the results went.
+            std::ostream& report = json && *json == "-" ? std::cerr : std::cout;
+            std::vector<std::string> missing = RegressionGate::unmatched(baseline, current);
+            std::vector<std::string> unbaselined = RegressionGate::unmatched(current, baseline);
+            for (const std::string& key : missing) {
+                report << "Missing from this run: " << key << "\n";
+            }
+            for (const std::string& key : unbaselined) {
+                report << "Not in the baseline: " << key << "\n";
+            }
+            size_t regressions = reportRegressions(report, RegressionGate::compare(baseline, current, tolerances));
+            if (regressions > 0 || !missing.empty() || !unbaselined.empty()) {
+                return 2;
+            }
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,172 @@
+#ifndef BENCH_CORPUS_HPP
+#define BENCH_CORPUS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Deterministic synthetic inputs for the benchmarks. Everything is derived
+// from a fixed-seed splitmix64 stream with hand-written distributions (the
+// std:: ones differ between standard libraries), so a given name and size
+// produce the same bytes on every machine and results stay comparable.
+struct Corpus {
+    std::string name;
+    std::vector<uint8_t> data;
+};
+
+class CorpusGenerator {
+public:
+    static std::vector<std::string> names() {
+        return {"random", "text", "runs", "binary", "records"};
+    }
+
+    static Corpus make(const std::string& name, size_t size) {
+        Random rng(seed(name));
+        std::vector<uint8_t> data;
+        data.reserve(size + 256);
+        if (name == "random") {
+            random(rng, size, data);
+        } else if (name == "text") {
+            text(rng, size, data);
+        } else if (name == "runs") {
+            runs(rng, size, data);
+        } else if (name == "binary") {
+            binary(rng, size, data);
+        } else if (name == "records") {
+            records(rng, size, data);
+        } else {
+            throw std::runtime_error("Unknown corpus: " + name);
+        }
+        data.resize(size);
+        return {name, std::move(data)};
+    }
+
+private:
+    static uint64_t seed(const std::string& name) {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (char c : name) {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    class Random {
+    public:
+        explicit Random(uint64_t seed) : state_(seed) {}
+
+        uint64_t next() {
+            uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        uint32_t below(uint32_t bound) { return static_cast<uint32_t>(next() % bound); }
+        double unit() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    private:
+        uint64_t state_;
+    };
+
+    // Uniform bytes: nothing to find.
+    static void random(Random& rng, size_t size, std::vector<uint8_t>& out) {
+        while (out.size() < size) {
+            uint64_t word = rng.next();
+            for (int i = 0; i < 8; i++) {
+                out.push_back(static_cast<uint8_t>(word >> (8 * i)));
+            }
+        }
+    }
+
+    // Words drawn from a Zipf(1.1) vocabulary, like natural-language text.
+    static void text(Random& rng, size_t size, std::vector<uint8_t>& out) {
+        const size_t vocabulary_size = 4096;
+        std::vector<std::string> words;
+        std::vector<double> cdf;
+        double total = 0.0;
+        for (size_t rank = 1; rank <= vocabulary_size; rank++) {
+            std::string word;
+            size_t length = 2 + rng.below(3);
+            if (rank > 64) {
+                length += rng.below(6);
+            }
+            for (size_t i = 0; i < length; i++) {
+                word.push_back(static_cast<char>('a' + rng.below(26)));
+            }
+            words.push_back(word);
+            total += 1.0 / std::pow(static_cast<double>(rank), 1.1);
+            cdf.push_back(total);
+        }
+
+        size_t words_in_line = 0;
+        while (out.size() < size) {
+            double pick = rng.unit() * total;
+            size_t rank = std::lower_bound(cdf.begin(), cdf.end(), pick) - cdf.begin();
+            const std::string& word = words[std::min(rank, vocabulary_size - 1)];
+            out.insert(out.end(), word.begin(), word.end());
+            if (++words_in_line >= 8 + rng.below(8)) {
+                out.push_back('.');
+                out.push_back('\n');
+                words_in_line = 0;
+            } else {
+                out.push_back(' ');
+            }
+        }
+    }
+
+    // Long runs of a few values, like bitmaps or sparse arrays.
+    static void runs(Random& rng, size_t size, std::vector<uint8_t>& out) {
+        while (out.size() < size) {
+            uint8_t value = rng.below(4) == 0 ? static_cast<uint8_t>(rng.below(256)) : 0;
+            size_t length = 1 + rng.below(rng.below(8) == 0 ? 4 : 300);
+            out.insert(out.end(), std::min(length, size - out.size()), value);
+        }
+    }
+
+    // Fixed 32-byte little-endian records: sequential ids, slowly rising
+    // timestamps, small enums and a random-walk measurement.
+    static void binary(Random& rng, size_t size, std::vector<uint8_t>& out) {
+        uint32_t id = 1000;
+        uint64_t timestamp = 1700000000000ull;
+        int32_t value = 0;
+        auto put = [&](uint64_t field, int bytes) {
+            for (int i = 0; i < bytes; i++) {
+                out.push_back(static_cast<uint8_t>(field >> (8 * i)));
+            }
+        };
+        while (out.size() < size) {
+            timestamp += 1 + rng.below(50);
+            value += static_cast<int32_t>(rng.below(201)) - 100;
+            put(id++, 4);
+            put(timestamp, 8);
+            put(rng.below(8), 2);
+            put(static_cast<uint32_t>(value), 4);
+            put(rng.below(4) == 0 ? rng.next() : 0, 8);
+            put(0, 6);
+        }
+    }
+
+    // Log-style text lines built from a few templates with varying fields.
+    static void records(Random& rng, size_t size, std::vector<uint8_t>& out) {
+        static const char* const actions[] = {"login", "logout", "view", "purchase", "search"};
+        static const char* const statuses[] = {"ok", "ok", "ok", "denied", "timeout"};
+        uint64_t sequence = 1;
+        while (out.size() < size) {
+            // Draw the fields one statement at a time: operand order in a
+            // single expression is unspecified and would change the bytes.
+            uint32_t user = rng.below(500);
+            const char* action = actions[rng.below(5)];
+            const char* status = statuses[rng.below(5)];
+            uint32_t latency = rng.below(1000);
+            std::string line = "seq=" + std::to_string(sequence++) + " user=u" + std::to_string(user) +
+                               " action=" + action + " status=" + status +
+                               " latency_ms=" + std::to_string(latency) + "\n";
+            out.insert(out.end(), line.begin(), line.end());
+        }
+    }
+};
+
+#endif
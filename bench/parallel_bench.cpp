@@ -0,0 +1,115 @@
+// Times the multi-threaded codec paths against their serial versions on
+// one in-memory buffer, and checks the outputs are identical. The
+// container rows run whole block streams through the work-stealing
+// executor, with adaptive per-block codec choice so block costs differ.
+//
+//   g++ -std=c++17 -O2 -pthread bench/parallel_bench.cpp -o parallel_bench
+//   ./parallel_bench [size] [repetitions] [threads ...]
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../include/container.hpp"
+#include "../include/huffman.hpp"
+#include "../include/rle.hpp"
+#include "corpus.hpp"
+
+template <typename Fn>
+double bestSeconds(int repetitions, Fn fn) {
+    double best = 1e300;
+    for (int i = 0; i < repetitions; i++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+// One row per thread count: MB/s and whether the output matches the
+// single-threaded bytes.
+template <typename Fn>
+bool row(const std::string& name, const Corpus& corpus, const std::vector<unsigned>& threads, int repetitions,
+         Fn run) {
+    std::vector<uint8_t> serial = run(1u);
+    bool ok = true;
+    double mb = corpus.data.size() / 1e6;
+    for (unsigned count : threads) {
+        std::vector<uint8_t> result;
+        double seconds = bestSeconds(repetitions, [&] { result = run(count); });
+        bool same = result == serial;
+        ok &= same;
+        std::cout << std::left << std::setw(18) << name << std::setw(10) << corpus.name << std::right
+                  << std::setw(8) << count << std::fixed << std::setprecision(1) << std::setw(12) << mb / seconds
+                  << std::setw(8) << (same ? "yes" : "NO") << "\n";
+    }
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    size_t size = argc > 1 ? std::stoul(argv[1]) : (16u << 20);
+    int repetitions = argc > 2 ? std::stoi(argv[2]) : 3;
+    std::vector<unsigned> threads;
+    for (int i = 3; i < argc; i++) {
+        threads.push_back(static_cast<unsigned>(std::stoul(argv[i])));
+    }
+    if (threads.empty()) {
+        threads = {1, 2, 4, Parallel::resolve(0)};
+    }
+
+    std::cout << "MB/s on " << size << " bytes, best of " << repetitions << "\n";
+    std::cout << std::left << std::setw(18) << "codec" << std::setw(10) << "corpus" << std::right << std::setw(8)
+              << "threads" << std::setw(12) << "MB/s" << std::setw(8) << "same" << "\n";
+
+    bool ok = true;
+    for (const char* name : {"text", "binary", "runs", "random"}) {
+        Corpus corpus = CorpusGenerator::make(name, size);
+        ok &= row("huffman encode", corpus, threads, repetitions, [&](unsigned count) {
+            return Huffman::compressFramed(corpus.data, 0, count);
+        });
+        std::vector<uint8_t> checkpointed =
+            Huffman::compressFramed(corpus.data, 0, 0, Huffman::DEFAULT_CHECKPOINT_INTERVAL);
+        ok &= Huffman::decompressFramed(checkpointed) == corpus.data;
+        ok &= row("huffman decode", corpus, threads, repetitions, [&](unsigned count) {
+            return Huffman::decompressFramed(checkpointed, count);
+        });
+        ok &= row("rle encode", corpus, threads, repetitions, [&](unsigned count) {
+            return RLE::compress(corpus.data, count);
+        });
+        std::vector<uint8_t> runs = RLE::compress(corpus.data);
+        ok &= RLE::decompress(runs) == corpus.data;
+        ok &= row("rle decode", corpus, threads, repetitions, [&](unsigned count) {
+            return RLE::decompress(runs, count);
+        });
+
+        CompressionLevel level = CompressionLevel::get(CompressionLevel::DEFAULT);
+        level.block_size = 256 * 1024;
+        std::string raw(corpus.data.begin(), corpus.data.end());
+        auto containerCompress = [&](unsigned count) {
+            std::istringstream in(raw);
+            std::ostringstream out;
+            Container::compressAdaptive(in, out, level, count);
+            std::string bytes = out.str();
+            return std::vector<uint8_t>(bytes.begin(), bytes.end());
+        };
+        ok &= row("container encode", corpus, threads, repetitions, containerCompress);
+        std::string container;
+        {
+            std::vector<uint8_t> bytes = containerCompress(1);
+            container.assign(bytes.begin(), bytes.end());
+        }
+        auto containerDecompress = [&](unsigned count) {
+            std::istringstream in(container);
+            std::ostringstream out;
+            Container::decompress(in, out, count);
+            std::string bytes = out.str();
+            return std::vector<uint8_t>(bytes.begin(), bytes.end());
+        };
+        ok &= containerDecompress(1) == corpus.data;
+        ok &= row("container decode", corpus, threads, repetitions, containerDecompress);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,323 @@
+#ifndef BENCH_RESULTS_HPP
+#define BENCH_RESULTS_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <istream>
+#include <iterator>
+#include <map>
+#include <ostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// One benchmark row. Throughputs are medians over the repetitions, each
+// with its median absolute deviation as the noise estimate.
+struct BenchResult {
+    std::string codec;
+    std::string corpus;
+    uint64_t size = 0;
+    uint64_t compressed_size = 0;
+    double ratio = 0.0;  // input / output
+    double compress_mbps = 0.0;
+    double compress_mbps_mad = 0.0;
+    double decompress_mbps = 0.0;
+    double decompress_mbps_mad = 0.0;
+    double compress_cycles_per_byte = 0.0;
+    double decompress_cycles_per_byte = 0.0;
+    uint64_t compress_peak_bytes = 0;
+    uint64_t decompress_peak_bytes = 0;
+    double compress_allocations_per_call = 0.0;  // after warmup
+    double decompress_allocations_per_call = 0.0;
+    bool round_trip = false;
+
+    std::string key() const { return codec + "/" + corpus + "/" + std::to_string(size); }
+};
+
+struct BenchRun {
+    int level = 0;
+    int repetitions = 0;
+    std::vector<BenchResult> results;
+};
+
+class Statistics {
+public:
+    static double median(std::vector<double> values) {
+        if (values.empty()) {
+            return 0.0;
+        }
+        std::sort(values.begin(), values.end());
+        size_t middle = values.size() / 2;
+        return values.size() % 2 == 1 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+    }
+
+    static double mad(const std::vector<double>& values) {
+        double center = median(values);
+        std::vector<double> deviations;
+        for (double value : values) {
+            deviations.push_back(std::fabs(value - center));
+        }
+        return median(deviations);
+    }
+};
+
+// Reads and writes the benchmark JSON. The reader accepts general JSON but
+// only picks out the fields written here; unknown fields are ignored, so
+// newer files still load as baselines.
+class ResultsFile {
+public:
+    static void write(std::ostream& out, const BenchRun& run) {
+        out << "{\n  \"level\": " << run.level << ",\n  \"repetitions\": " << run.repetitions
+            << ",\n  \"results\": [";
+        out << std::setprecision(6);
+        for (size_t i = 0; i < run.results.size(); i++) {
+            const BenchResult& r = run.results[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"codec\": \"" << r.codec << "\", \"corpus\": \"" << r.corpus
+                << "\", \"size\": " << r.size << ", \"compressed_size\": " << r.compressed_size
+                << ", \"ratio\": " << r.ratio << ", \"compress_mbps\": " << r.compress_mbps
+                << ", \"compress_mbps_mad\": " << r.compress_mbps_mad
+                << ", \"decompress_mbps\": " << r.decompress_mbps
+                << ", \"decompress_mbps_mad\": " << r.decompress_mbps_mad
+                << ", \"compress_cycles_per_byte\": " << r.compress_cycles_per_byte
+                << ", \"decompress_cycles_per_byte\": " << r.decompress_cycles_per_byte
+                << ", \"compress_peak_bytes\": " << r.compress_peak_bytes
+                << ", \"decompress_peak_bytes\": " << r.decompress_peak_bytes
+                << ", \"compress_allocations_per_call\": " << r.compress_allocations_per_call
+                << ", \"decompress_allocations_per_call\": " << r.decompress_allocations_per_call
+                << ", \"round_trip\": " << (r.round_trip ? "true" : "false") << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+    static BenchRun read(std::istream& in) {
+        std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        Parser parser(text);
+        Value root = parser.parse();
+
+        BenchRun run;
+        run.level = static_cast<int>(root.number("level"));
+        run.repetitions = static_cast<int>(root.number("repetitions"));
+        for (const Value& row : root.field("results").items) {
+            BenchResult r;
+            r.codec = row.field("codec").text;
+            r.corpus = row.field("corpus").text;
+            r.size = static_cast<uint64_t>(row.number("size"));
+            r.compressed_size = static_cast<uint64_t>(row.number("compressed_size"));
+            r.ratio = row.number("ratio");
+            r.compress_mbps = row.number("compress_mbps");
+            r.compress_mbps_mad = row.number("compress_mbps_mad");
+            r.decompress_mbps = row.number("decompress_mbps");
+            r.decompress_mbps_mad = row.number("decompress_mbps_mad");
+            r.compress_cycles_per_byte = row.number("compress_cycles_per_byte");
+            r.decompress_cycles_per_byte = row.number("decompress_cycles_per_byte");
+            r.compress_peak_bytes = static_cast<uint64_t>(row.number("compress_peak_bytes"));
+            r.decompress_peak_bytes = static_cast<uint64_t>(row.number("decompress_peak_bytes"));
+            r.compress_allocations_per_call = row.number("compress_allocations_per_call");
+            r.decompress_allocations_per_call = row.number("decompress_allocations_per_call");
+            r.round_trip = row.field("round_trip").flag;
+            run.results.push_back(r);
+        }
+        return run;
+    }
+
+private:
+    struct Value {
+        double value = 0.0;
+        bool flag = false;
+        std::string text;
+        std::vector<Value> items;
+        std::map<std::string, Value> fields;
+
+        const Value& field(const std::string& name) const {
+            static const Value missing;
+            auto found = fields.find(name);
+            return found == fields.end() ? missing : found->second;
+        }
+        double number(const std::string& name) const { return field(name).value; }
+    };
+
+    class Parser {
+    public:
+        explicit Parser(const std::string& text) : text_(text) {}
+
+        Value parse() {
+            Value value = parseValue();
+            skipSpace();
+            if (pos_ != text_.size()) {
+                fail();
+            }
+            return value;
+        }
+
+    private:
+        const std::string& text_;
+        size_t pos_ = 0;
+
+        [[noreturn]] void fail() const {
+            throw std::runtime_error("Invalid results JSON at offset " + std::to_string(pos_));
+        }
+
+        void skipSpace() {
+            while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+                pos_++;
+            }
+        }
+
+        void expect(char c) {
+            skipSpace();
+            if (pos_ >= text_.size() || text_[pos_] != c) {
+                fail();
+            }
+            pos_++;
+        }
+
+        bool consume(char c) {
+            skipSpace();
+            if (pos_ < text_.size() && text_[pos_] == c) {
+                pos_++;
+                return true;
+            }
+            return false;
+        }
+
+        Value parseValue() {
+            skipSpace();
+            if (pos_ >= text_.size()) {
+                fail();
+            }
+            Value value;
+            char c = text_[pos_];
+            if (c == '{') {
+                pos_++;
+                if (!consume('}')) {
+                    do {
+                        std::string name = parseString();
+                        expect(':');
+                        value.fields[name] = parseValue();
+                    } while (consume(','));
+                    expect('}');
+                }
+            } else if (c == '[') {
+                pos_++;
+                if (!consume(']')) {
+                    do {
+                        value.items.push_back(parseValue());
+                    } while (consume(','));
+                    expect(']');
+                }
+            } else if (c == '"') {
+                value.text = parseString();
+            } else if (text_.compare(pos_, 4, "true") == 0) {
+                value.flag = true;
+                pos_ += 4;
+            } else if (text_.compare(pos_, 5, "false") == 0) {
+                pos_ += 5;
+            } else if (text_.compare(pos_, 4, "null") == 0) {
+                pos_ += 4;
+            } else {
+                size_t used = 0;
+                try {
+                    value.value = std::stod(text_.substr(pos_, 32), &used);
+                } catch (const std::exception&) {
+                    fail();
+                }
+                pos_ += used;
+            }
+            return value;
+        }
+
+        std::string parseString() {
+            expect('"');
+            std::string result;
+            while (pos_ < text_.size() && text_[pos_] != '"') {
+                if (text_[pos_] == '\\' && pos_ + 1 < text_.size()) {
+                    pos_++;
+                }
+                result.push_back(text_[pos_++]);
+            }
+            expect('"');
+            return result;
+        }
+    };
+};
+
+// Compares a run against a baseline row by row. A throughput drop counts
+// as a regression only when it is beyond the relative tolerance and also
+// beyond `noise_mads` times the larger of the two MADs (scaled to a
+// standard deviation), so jitter on a busy machine does not fail the gate.
+// Ratio is deterministic and only gets the relative tolerance.
+struct RegressionTolerances {
+    double throughput = 0.10;
+    double ratio = 0.005;
+    double noise_mads = 3.0;
+};
+
+class RegressionGate {
+public:
+    struct Finding {
+        std::string key;
+        std::string metric;
+        double baseline;
+        double current;
+        bool regression;
+    };
+
+    static std::vector<Finding> compare(const BenchRun& baseline, const BenchRun& current,
+                                        const RegressionTolerances& tolerances) {
+        std::map<std::string, const BenchResult*> previous;
+        for (const BenchResult& r : baseline.results) {
+            previous[r.key()] = &r;
+        }
+
+        std::vector<Finding> findings;
+        for (const BenchResult& r : current.results) {
+            auto found = previous.find(r.key());
+            if (found == previous.end()) {
+                continue;
+            }
+            const BenchResult& b = *found->second;
+            findings.push_back(throughput(r.key(), "compress MB/s", b.compress_mbps, b.compress_mbps_mad,
+                                          r.compress_mbps, r.compress_mbps_mad, tolerances));
+            findings.push_back(throughput(r.key(), "decompress MB/s", b.decompress_mbps, b.decompress_mbps_mad,
+                                          r.decompress_mbps, r.decompress_mbps_mad, tolerances));
+            findings.push_back({r.key(), "ratio", b.ratio, r.ratio, r.ratio < b.ratio * (1.0 - tolerances.ratio)});
+        }
+        return findings;
+    }
+
+    // Keys of rows in `run` that `other` lacks. compare() skips them, so
+    // the caller reports them rather than letting a gate over fewer rows
+    // pass.
+    static std::vector<std::string> unmatched(const BenchRun& run, const BenchRun& other) {
+        std::set<std::string> keys;
+        for (const BenchResult& r : other.results) {
+            keys.insert(r.key());
+        }
+        std::vector<std::string> missing;
+        for (const BenchResult& r : run.results) {
+            if (!keys.count(r.key())) {
+                missing.push_back(r.key());
+            }
+        }
+        return missing;
+    }
+
+private:
+    // MAD * 1.4826 estimates the standard deviation of normal noise.
+    static constexpr double MAD_TO_SIGMA = 1.4826;
+
+    static Finding throughput(const std::string& key, const std::string& metric, double baseline,
+                              double baseline_mad, double current, double current_mad,
+                              const RegressionTolerances& tolerances) {
+        double noise = tolerances.noise_mads * MAD_TO_SIGMA * std::max(baseline_mad, current_mad);
+        bool slower = current < baseline * (1.0 - tolerances.throughput);
+        bool beyond_noise = baseline - current > noise;
+        return {key, metric, baseline, current, slower && beyond_noise};
+    }
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef ALLOCATION_HPP
+#define ALLOCATION_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// Per-thread heap allocation counters. They only move in programs that
+// include allocation_hook.hpp, which replaces the global operator new;
+// everywhere else they read zero and installed() is false.
+//
+// Live bytes are charged to the allocating thread and credited to the
+// freeing one, so for work that hands buffers between threads only the
+// sum over threads is meaningful.
+struct AllocationCounter {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    int64_t live_bytes = 0;
+    int64_t peak_live_bytes = 0;
+
+    static AllocationCounter& local() {
+        thread_local AllocationCounter counter;
+        return counter;
+    }
+
+    static bool& installed() {
+        static bool hooked = false;
+        return hooked;
+    }
+
+    void onAllocate(uint64_t size) {
+        allocations++;
+        bytes += size;
+        live_bytes += static_cast<int64_t>(size);
+        peak_live_bytes = std::max(peak_live_bytes, live_bytes);
+    }
+
+    void onFree(uint64_t size) { live_bytes -= static_cast<int64_t>(size); }
+};
+
+// Measures the calling thread's allocations from construction on: count,
+// bytes, and the peak of live bytes above the starting level. Scopes nest;
+// each restores the enclosing high-water mark when it ends.
+class AllocationScope {
+public:
+    AllocationScope()
+        : start_(AllocationCounter::local()), saved_peak_(start_.peak_live_bytes) {
+        AllocationCounter::local().peak_live_bytes = start_.live_bytes;
+    }
+
+    ~AllocationScope() {
+        AllocationCounter& counter = AllocationCounter::local();
+        counter.peak_live_bytes = std::max(saved_peak_, counter.peak_live_bytes);
+    }
+
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+
+    uint64_t allocations() const { return AllocationCounter::local().allocations - start_.allocations; }
+    uint64_t bytes() const { return AllocationCounter::local().bytes - start_.bytes; }
+    uint64_t peakBytes() const {
+        return static_cast<uint64_t>(std::max<int64_t>(AllocationCounter::local().peak_live_bytes - start_.live_bytes, 0));
+    }
+
+    // Runs `fn` and throws if it touched the heap on this thread. Meant for
+    // warmed-up codec contexts in benchmarks and tests; without the hook
+    // nothing is counted and it always passes.
+    template <typename Fn>
+    static void requireNone(const std::string& what, Fn fn) {
+        AllocationScope scope;
+        fn();
+        if (scope.allocations() > 0) {
+            throw std::runtime_error(what + " allocated " + std::to_string(scope.allocations()) + " times (" +
+                                     std::to_string(scope.bytes()) + " bytes)");
+        }
+    }
+
+private:
+    AllocationCounter start_;
+    int64_t saved_peak_;
+};
+
+#endif
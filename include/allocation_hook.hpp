@@ -0,0 +1,73 @@
+#ifndef ALLOCATION_HOOK_HPP
+#define ALLOCATION_HOOK_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "allocation.hpp"
+
+// Replaces the global operator new to feed AllocationCounter. Replacement
+// allocation functions may be defined only once per program, so include
+// this from exactly one translation unit (the one with main()).
+//
+// Each block carries its size in a header so frees can be counted too.
+// Over-aligned new/delete keep the library versions and are not counted.
+
+namespace allocation_hook {
+constexpr std::size_t HEADER = alignof(std::max_align_t);
+
+inline void* allocate(std::size_t size) {
+    void* block = std::malloc(size + HEADER);
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    *static_cast<std::size_t*>(block) = size;
+    AllocationCounter::local().onAllocate(size);
+    return static_cast<char*>(block) + HEADER;
+}
+
+// Both ends of every replaced pair come here, so memory from any form of
+// new is returned by any form of delete. GCC cannot see that the pair is
+// replaced and warns when a pointer from operator new reaches free().
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+inline void release(void* pointer) noexcept {
+    if (pointer == nullptr) {
+        return;
+    }
+    void* block = static_cast<char*>(pointer) - HEADER;
+    AllocationCounter::local().onFree(*static_cast<std::size_t*>(block));
+    std::free(block);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+inline void* allocateNothrow(std::size_t size) noexcept {
+    try {
+        return allocate(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+inline const bool installed = (AllocationCounter::installed() = true);
+}  // namespace allocation_hook
+
+void* operator new(std::size_t size) { return allocation_hook::allocate(size); }
+void* operator new[](std::size_t size) { return allocation_hook::allocate(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return allocation_hook::allocateNothrow(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return allocation_hook::allocateNothrow(size);
+}
+void operator delete(void* pointer) noexcept { allocation_hook::release(pointer); }
+void operator delete[](void* pointer) noexcept { allocation_hook::release(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { allocation_hook::release(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { allocation_hook::release(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { allocation_hook::release(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { allocation_hook::release(pointer); }
+
+#endif
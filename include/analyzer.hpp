@@ -0,0 +1,210 @@
+#ifndef ANALYZER_HPP
+#define ANALYZER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "level.hpp"
+#include "pipeline.hpp"
+#include "stats.hpp"
+
+// Cheap input statistics for automatic codec selection. A handful of
+// windows spread across the input stand in for the whole file, so the cost
+// is fixed no matter how large the input is.
+struct SampleStats {
+    size_t sampled_bytes = 0;
+    double entropy = 0.0;          // order-0, bits per byte
+    double mean_run_length = 1.0;  // bytes per run of equal bytes
+    double repeat_density = 0.0;   // share of 4-byte windows seen earlier
+};
+
+class Analyzer {
+public:
+    static constexpr size_t WINDOW_SIZE = 4096;
+    static constexpr size_t WINDOW_COUNT = 16;
+
+    static SampleStats sample(const uint8_t* data, size_t size) {
+        PhaseTimer timer("analyze.sample", size);
+        Accumulator accumulator;
+        forEachWindow(size, WINDOW_COUNT, WINDOW_SIZE, [&](size_t offset, size_t length) {
+            accumulator.add(data + offset, length);
+        });
+        return accumulator.finish();
+    }
+
+    static std::vector<StageSpec> choose(const SampleStats& stats, Target target) {
+        // Long runs: RLE collapses them; Huffman squeezes the skewed pairs.
+        if (stats.mean_run_length >= 4.0) {
+            if (target == Target::Speed) {
+                return {StageId::RLE};
+            }
+            return {StageId::RLE, StageId::Huffman};
+        }
+        // Near-random bytes with no repeats: every codec expands them.
+        if (isIncompressible(stats)) {
+            return {};
+        }
+        // Repeated strings: dictionary or block-sorting codecs.
+        if (stats.repeat_density >= 0.3) {
+            if (target == Target::Speed) {
+                return {StageId::LZW};
+            }
+            if (target == Target::Balanced) {
+                return {StageId::LZW, StageId::Huffman};
+            }
+            return {StageId::BWT, StageId::Huffman};
+        }
+        // Skewed byte distribution without much structure.
+        if (target == Target::Ratio) {
+            return {StageId::BWT, StageId::Huffman};
+        }
+        return {StageId::Huffman};
+    }
+
+    static bool isIncompressible(const SampleStats& stats) {
+        return stats.entropy > 7.5 && stats.repeat_density < 0.1 && stats.mean_run_length < 1.5;
+    }
+
+    // Picks a stage list for one block, configured for `level`; an empty
+    // list means stored. The speed target trusts the sampled estimates
+    // alone. Otherwise every candidate is trial-compressed on slices of the
+    // block, and the balanced target charges slower chains a small size
+    // penalty.
+    static std::vector<StageSpec> chooseBlock(const uint8_t* data, size_t size, const CompressionLevel& level,
+                                              PipelineCache& pipelines) {
+        return chooseBlock(data, size, sample(data, size), level, pipelines);
+    }
+
+    // As above, with the block's stats already sampled.
+    static std::vector<StageSpec> chooseBlock(const uint8_t* data, size_t size, const SampleStats& stats,
+                                              const CompressionLevel& level, PipelineCache& pipelines) {
+        Target target = level.target;
+        if (target == Target::Speed || isIncompressible(stats)) {
+            return level.configure(choose(stats, target));
+        }
+
+        // A few contiguous slices, each trial-coded on its own: long enough
+        // for dictionary codecs to warm up, spread out to catch mixed blocks.
+        PhaseTimer timer("analyze.trial", size);
+        std::vector<std::vector<uint8_t>> slices;
+        forEachWindow(size, TRIAL_SLICES, TRIAL_SLICE_SIZE, [&](size_t offset, size_t length) {
+            slices.emplace_back(data + offset, data + offset + length);
+        });
+        size_t trial_size = 0;
+        for (const auto& slice : slices) {
+            trial_size += slice.size();
+        }
+
+        struct Candidate {
+            std::vector<StageSpec> specs;
+            int cost;
+        };
+        std::vector<Candidate> candidates = {
+            {{StageId::RLE}, 1},
+            {{StageId::Huffman}, 2},
+            {{StageId::RLE, StageId::Huffman}, 2},
+            {{StageId::LZW}, 4},
+            {{StageId::LZW, StageId::Huffman}, 5},
+        };
+        if (target == Target::Ratio) {
+            candidates.push_back({{StageId::BWT, StageId::Huffman}, 6});
+        }
+        double penalty = target == Target::Balanced ? 0.01 : 0.0;
+
+        std::vector<StageSpec> best;
+        double best_score = static_cast<double>(trial_size);
+        std::vector<uint8_t> encoded;
+        std::vector<uint8_t> scratch;
+        for (Candidate& candidate : candidates) {
+            candidate.specs = level.configure(candidate.specs);
+            size_t encoded_size = 0;
+            for (const auto& slice : slices) {
+                pipelines.get(candidate.specs).encodeBlock(slice, encoded, scratch);
+                encoded_size += encoded.size();
+            }
+            double score = encoded_size * (1.0 + penalty * candidate.cost);
+            if (score < best_score) {
+                best_score = score;
+                best = candidate.specs;
+            }
+        }
+        return best;
+    }
+
+private:
+    static constexpr size_t TRIAL_SLICES = 3;
+    static constexpr size_t TRIAL_SLICE_SIZE = 32 * 1024;
+
+    class Accumulator {
+    public:
+        void add(const uint8_t* data, size_t length) {
+            if (length == 0) {
+                return;
+            }
+            for (size_t i = 0; i < length; i++) {
+                histogram_[data[i]]++;
+                if (i == 0 || data[i] != data[i - 1]) {
+                    runs_++;
+                }
+            }
+            for (size_t i = 0; i + 4 <= length; i++) {
+                uint32_t word = static_cast<uint32_t>(data[i]) | (static_cast<uint32_t>(data[i + 1]) << 8) |
+                                (static_cast<uint32_t>(data[i + 2]) << 16) |
+                                (static_cast<uint32_t>(data[i + 3]) << 24);
+                uint32_t slot = (word * 2654435761u) >> (32 - HASH_BITS);
+                if (seen_[slot] == word + 1) {
+                    repeats_++;
+                }
+                seen_[slot] = word + 1;
+                windows_++;
+            }
+            bytes_ += length;
+        }
+
+        SampleStats finish() const {
+            SampleStats stats;
+            stats.sampled_bytes = bytes_;
+            if (bytes_ == 0) {
+                return stats;
+            }
+            for (uint64_t count : histogram_) {
+                if (count > 0) {
+                    double p = static_cast<double>(count) / bytes_;
+                    stats.entropy -= p * std::log2(p);
+                }
+            }
+            stats.mean_run_length = static_cast<double>(bytes_) / runs_;
+            stats.repeat_density = windows_ == 0 ? 0.0 : static_cast<double>(repeats_) / windows_;
+            return stats;
+        }
+
+    private:
+        static constexpr int HASH_BITS = 12;
+
+        std::array<uint64_t, 256> histogram_{};
+        std::vector<uint64_t> seen_ = std::vector<uint64_t>(size_t(1) << HASH_BITS, 0);
+        uint64_t bytes_ = 0;
+        uint64_t runs_ = 0;
+        uint64_t windows_ = 0;
+        uint64_t repeats_ = 0;
+    };
+
+    template <typename Fn>
+    static void forEachWindow(size_t size, size_t count, size_t window, Fn fn) {
+        if (size <= window * count) {
+            for (size_t offset = 0; offset < size; offset += window) {
+                fn(offset, std::min(window, size - offset));
+            }
+            return;
+        }
+        size_t stride = (size - window) / (count - 1);
+        for (size_t i = 0; i < count; i++) {
+            fn(i * stride, window);
+        }
+    }
+};
+
+#endif
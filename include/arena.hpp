@@ -0,0 +1,177 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+// Bump allocator for codec scratch memory. Allocation advances a pointer
+// through a list of chunks; nothing is freed individually. An ArenaScope
+// records the position on entry and rewinds to it on exit, which releases
+// everything allocated inside in O(1). Chunks are kept for reuse, so once
+// an arena has grown to fit a thread's largest block it stops touching
+// the heap altogether.
+//
+// Each thread has its own arena (Arena::local()), so codecs running on
+// different threads never contend on a lock.
+class Arena {
+public:
+    static constexpr size_t MIN_CHUNK = 64 * 1024;
+
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    static Arena& local() {
+        thread_local Arena arena;
+        return arena;
+    }
+
+    // The calling thread's arena while an ArenaScope is open on it, else
+    // null: scratch allocated outside any scope would never be released,
+    // so it goes to the heap instead.
+    static Arena* current() {
+        Arena& arena = local();
+        return arena.depth_ > 0 ? &arena : nullptr;
+    }
+
+    void* allocate(size_t size, size_t alignment) {
+        while (true) {
+            if (chunk_ < chunks_.size()) {
+                Chunk& chunk = chunks_[chunk_];
+                size_t aligned = (offset_ + alignment - 1) & ~(alignment - 1);
+                if (aligned + size <= chunk.size) {
+                    offset_ = aligned + size;
+                    return chunk.data.get() + aligned;
+                }
+                if (chunk_ + 1 < chunks_.size() && chunks_[chunk_ + 1].size >= size + alignment) {
+                    chunk_++;
+                    offset_ = 0;
+                    continue;
+                }
+            }
+            grow(size + alignment);
+        }
+    }
+
+    struct Mark {
+        size_t chunk;
+        size_t offset;
+    };
+
+    Mark mark() const { return {chunk_, offset_}; }
+    void rewind(Mark mark) {
+        chunk_ = mark.chunk;
+        offset_ = mark.offset;
+    }
+
+    // Total bytes held in chunks, used or not.
+    size_t reserved() const {
+        size_t total = 0;
+        for (const Chunk& chunk : chunks_) {
+            total += chunk.size;
+        }
+        return total;
+    }
+
+    // Returns every chunk to the heap. Only valid with no scope open.
+    void release() {
+        chunks_.clear();
+        chunk_ = 0;
+        offset_ = 0;
+    }
+
+private:
+    friend class ArenaScope;
+
+    struct Chunk {
+        std::unique_ptr<uint8_t[]> data;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks_;
+    size_t chunk_ = 0;  // chunk being bumped through
+    size_t offset_ = 0;
+    int depth_ = 0;
+
+    // Inserts a chunk after the current one, so chunks already handed out
+    // below the current position stay where they are.
+    void grow(size_t at_least) {
+        size_t size = std::max({MIN_CHUNK, at_least, chunks_.empty() ? 0 : chunks_.back().size * 2});
+        size_t position = chunks_.empty() ? 0 : chunk_ + 1;
+        chunks_.insert(chunks_.begin() + position, Chunk{std::unique_ptr<uint8_t[]>(new uint8_t[size]), size});
+        chunk_ = position;
+        offset_ = 0;
+    }
+};
+
+// Everything the thread allocates from its arena while the scope is open
+// is released when it closes. Scopes nest. Containers built with
+// ArenaAllocator inside a scope must not outlive it.
+class ArenaScope {
+public:
+    ArenaScope() : arena_(Arena::local()), mark_(arena_.mark()) { arena_.depth_++; }
+
+    ~ArenaScope() {
+        arena_.depth_--;
+        arena_.rewind(mark_);
+    }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    Arena& arena_;
+    Arena::Mark mark_;
+};
+
+// Standard allocator over Arena::current(), captured when the allocator is
+// made: containers created inside an ArenaScope draw from the arena and
+// free nothing, those created outside use the ordinary heap.
+template <typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    ArenaAllocator() : arena_(Arena::current()) {}
+    explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+    T* allocate(size_t n) {
+        if (arena_) {
+            return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+        }
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* pointer, size_t n) {
+        if (!arena_) {
+            std::allocator<T>().deallocate(pointer, n);
+        }
+    }
+
+    Arena* arena() const { return arena_; }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena_ == other.arena(); }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena_ != other.arena(); }
+
+private:
+    Arena* arena_;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+using ArenaHashMap =
+    std::unordered_map<Key, Value, Hash, std::equal_to<Key>, ArenaAllocator<std::pair<const Key, Value>>>;
+
+#endif
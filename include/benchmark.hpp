@@ -0,0 +1,142 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iterator>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "container.hpp"
+#include "level.hpp"
+#include "pipeline.hpp"
+
+// In-process benchmark of whole-file compression on the caller's data, in
+// the spirit of `zstd -b`: every algorithm at every level goes through the
+// real container path in memory, timed over several iterations after a
+// warmup, and the decoded bytes are checked against the input.
+struct BenchmarkEntry {
+    std::string algorithm;
+    int level = 0;
+    uint64_t compressed_size = 0;
+    double ratio = 0.0;  // input / output
+    double compress_mbps = 0.0;
+    double decompress_mbps = 0.0;
+    bool round_trip = false;
+    bool pareto = false;  // no other entry is both smaller and faster to compress
+};
+
+class Benchmark {
+public:
+    static std::vector<std::string> algorithms() {
+        return {"rle", "huffman", "lzw", "bwt", "rle,huffman", "lzw,huffman", "auto"};
+    }
+
+    static std::vector<BenchmarkEntry> run(const std::vector<uint8_t>& data,
+                                           const std::vector<std::string>& algorithms,
+                                           const std::vector<int>& levels, int iterations, int warmup) {
+        std::string input(data.begin(), data.end());
+        std::vector<BenchmarkEntry> entries;
+        for (const std::string& algorithm : algorithms) {
+            for (int level_number : levels) {
+                CompressionLevel level = CompressionLevel::get(level_number);
+                std::string compressed;
+                std::string decompressed;
+                double compress_seconds = time(iterations, warmup, [&] {
+                    std::istringstream in(input);
+                    std::ostringstream out;
+                    if (algorithm == "auto") {
+                        Container::compressAdaptive(in, out, level);
+                    } else {
+                        Pipeline pipeline(level.configure(Pipeline::parseSpecs(algorithm)));
+                        Container::compress(in, out, pipeline, level.block_size);
+                    }
+                    compressed = out.str();
+                });
+                double decompress_seconds = time(iterations, warmup, [&] {
+                    std::istringstream in(compressed);
+                    std::ostringstream out;
+                    Container::decompress(in, out);
+                    decompressed = out.str();
+                });
+
+                BenchmarkEntry entry;
+                entry.algorithm = algorithm;
+                entry.level = level_number;
+                entry.compressed_size = compressed.size();
+                entry.ratio = compressed.empty() ? 0.0 : static_cast<double>(data.size()) / compressed.size();
+                entry.compress_mbps = mbPerSecond(data.size(), compress_seconds);
+                entry.decompress_mbps = mbPerSecond(data.size(), decompress_seconds);
+                entry.round_trip = decompressed == input;
+                entries.push_back(entry);
+            }
+        }
+        markPareto(entries);
+        return entries;
+    }
+
+    static void print(std::ostream& out, const std::vector<BenchmarkEntry>& entries, size_t input_size) {
+        out << "Input: " << input_size << " bytes\n";
+        out << std::left << std::setw(14) << "algorithm" << std::right << std::setw(6) << "level" << std::setw(12)
+            << "compressed" << std::setw(9) << "ratio" << std::setw(11) << "comp MB/s" << std::setw(11)
+            << "dec MB/s" << std::setw(8) << "pareto" << std::setw(6) << "ok" << "\n";
+        for (const BenchmarkEntry& e : entries) {
+            out << std::left << std::setw(14) << e.algorithm << std::right << std::setw(6) << e.level
+                << std::setw(12) << e.compressed_size << std::fixed << std::setprecision(3) << std::setw(9)
+                << e.ratio << std::setprecision(1) << std::setw(11) << e.compress_mbps << std::setw(11)
+                << e.decompress_mbps << std::setw(8) << (e.pareto ? "*" : "") << std::setw(6)
+                << (e.round_trip ? "yes" : "NO") << "\n";
+        }
+
+        // The front from fastest to smallest: the only settings worth picking.
+        std::vector<BenchmarkEntry> front;
+        std::copy_if(entries.begin(), entries.end(), std::back_inserter(front),
+                     [](const BenchmarkEntry& e) { return e.pareto; });
+        std::sort(front.begin(), front.end(), [](const BenchmarkEntry& a, const BenchmarkEntry& b) {
+            return a.compress_mbps > b.compress_mbps;
+        });
+        out << "\nPareto front (ratio vs compress MB/s):\n";
+        for (const BenchmarkEntry& e : front) {
+            out << "  -a " << std::left << std::setw(12) << e.algorithm << " -" << e.level << std::right
+                << std::fixed << std::setprecision(3) << std::setw(9) << e.ratio << std::setprecision(1)
+                << std::setw(11) << e.compress_mbps << " MB/s\n";
+        }
+    }
+
+private:
+    // Median wall time of `iterations` runs after `warmup` untimed ones.
+    template <typename Fn>
+    static double time(int iterations, int warmup, Fn fn) {
+        for (int i = 0; i < warmup; i++) {
+            fn();
+        }
+        std::vector<double> seconds;
+        for (int i = 0; i < iterations; i++) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            seconds.push_back(elapsed.count());
+        }
+        std::sort(seconds.begin(), seconds.end());
+        return seconds[seconds.size() / 2];
+    }
+
+    static double mbPerSecond(size_t bytes, double seconds) {
+        return seconds > 0 ? bytes / 1e6 / seconds : 0.0;
+    }
+
+    static void markPareto(std::vector<BenchmarkEntry>& entries) {
+        for (BenchmarkEntry& e : entries) {
+            e.pareto = e.round_trip && std::none_of(entries.begin(), entries.end(), [&](const BenchmarkEntry& other) {
+                return other.round_trip && other.ratio >= e.ratio && other.compress_mbps >= e.compress_mbps &&
+                       (other.ratio > e.ratio || other.compress_mbps > e.compress_mbps);
+            });
+        }
+    }
+};
+
+#endif
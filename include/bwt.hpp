@@ -0,0 +1,369 @@
+#ifndef BWT_HPP
+#define BWT_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "arena.hpp"
+#include "bytes.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+
+// Block-sorting transform: Burrows-Wheeler (suffix array built with SA-IS),
+// then move-to-front, then zero-run coding. The output is meant to be fed
+// into an entropy coder such as Huffman. Every block is independent, so
+// blocks are sorted and restored in parallel, each with its scratch in
+// the worker thread's arena.
+//
+// Stream layout, repeated per block:
+//   u32 original size | u32 primary index | u32 encoded size | encoded bytes
+//
+// Encoded byte alphabet: 0 = RUNA, 1 = RUNB (bijective base-2 zero runs),
+// 2..254 = MTF index + 1, 255 = escape followed by (MTF index - 254).
+class BWT {
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 900 * 1024;
+
+    static std::vector<uint8_t> compress(const std::vector<uint8_t>& data,
+                                         size_t block_size = DEFAULT_BLOCK_SIZE,
+                                         unsigned threads = 0) {
+        if (block_size == 0) {
+            throw std::runtime_error("BWT block size must be positive");
+        }
+        size_t block_count = (data.size() + block_size - 1) / block_size;
+        std::vector<std::vector<uint8_t>> blocks(block_count);
+
+        Parallel::forEach(block_count, threads, [&](size_t b) {
+            size_t begin = b * block_size;
+            size_t length = std::min(block_size, data.size() - begin);
+            blocks[b] = encodeBlock(data.data() + begin, length);
+        });
+
+        std::vector<uint8_t> compressed;
+        for (auto& block : blocks) {
+            compressed.insert(compressed.end(), block.begin(), block.end());
+        }
+        return compressed;
+    }
+
+    static std::vector<uint8_t> decompress(const std::vector<uint8_t>& data, unsigned threads = 0) {
+        struct BlockRef {
+            size_t input_offset;
+            size_t output_offset;
+            uint32_t original_size;
+            uint32_t primary;
+            uint32_t encoded_size;
+        };
+
+        std::vector<BlockRef> refs;
+        size_t offset = 0;
+        size_t total = 0;
+        while (offset < data.size()) {
+            if (data.size() - offset < 12) {
+                throw std::runtime_error("Corrupted BWT block header");
+            }
+            BlockRef ref;
+            ref.original_size = readUint32(data, offset);
+            ref.primary = readUint32(data, offset + 4);
+            ref.encoded_size = readUint32(data, offset + 8);
+            ref.input_offset = offset + 12;
+            ref.output_offset = total;
+            if (data.size() - ref.input_offset < ref.encoded_size || ref.primary > ref.original_size ||
+                (ref.primary == 0 && ref.original_size > 0)) {
+                throw std::runtime_error("Corrupted BWT block");
+            }
+            offset = ref.input_offset + ref.encoded_size;
+            total += ref.original_size;
+            refs.push_back(ref);
+        }
+
+        std::vector<uint8_t> decompressed(total);
+        Parallel::forEach(refs.size(), threads, [&](size_t b) {
+            const BlockRef& ref = refs[b];
+            decodeBlock(data.data() + ref.input_offset, ref.encoded_size, ref.primary,
+                        decompressed.data() + ref.output_offset, ref.original_size);
+        });
+        return decompressed;
+    }
+
+private:
+    static constexpr uint8_t RUNA = 0;
+    static constexpr uint8_t RUNB = 1;
+    static constexpr uint8_t ESCAPE = 255;
+
+    // SA-IS (Nong, Zhang & Chan). `s` must end with a unique smallest
+    // sentinel 0 and use symbols in [0, k).
+    static void getBuckets(const int* s, int n, int k, ArenaVector<int>& bucket, bool end) {
+        std::fill(bucket.begin(), bucket.end(), 0);
+        for (int i = 0; i < n; i++) {
+            bucket[s[i]]++;
+        }
+        int sum = 0;
+        for (int c = 0; c < k; c++) {
+            sum += bucket[c];
+            bucket[c] = end ? sum : sum - bucket[c];
+        }
+    }
+
+    static void induce(const int* s, int* sa, int n, int k, const ArenaVector<uint8_t>& stype,
+                       ArenaVector<int>& bucket) {
+        getBuckets(s, n, k, bucket, false);
+        for (int i = 0; i < n; i++) {
+            int j = sa[i] - 1;
+            if (sa[i] > 0 && !stype[j]) {
+                sa[bucket[s[j]]++] = j;
+            }
+        }
+        getBuckets(s, n, k, bucket, true);
+        for (int i = n - 1; i >= 0; i--) {
+            int j = sa[i] - 1;
+            if (sa[i] > 0 && stype[j]) {
+                sa[--bucket[s[j]]] = j;
+            }
+        }
+    }
+
+    static void sais(const int* s, int* sa, int n, int k) {
+        ArenaVector<uint8_t> stype(n);
+        stype[n - 1] = 1;
+        for (int i = n - 2; i >= 0; i--) {
+            stype[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && stype[i + 1]);
+        }
+        auto isLMS = [&](int i) { return i > 0 && stype[i] && !stype[i - 1]; };
+
+        ArenaVector<int> bucket(k);
+
+        // Sort LMS substrings.
+        getBuckets(s, n, k, bucket, true);
+        std::fill(sa, sa + n, -1);
+        for (int i = 1; i < n; i++) {
+            if (isLMS(i)) {
+                sa[--bucket[s[i]]] = i;
+            }
+        }
+        induce(s, sa, n, k, stype, bucket);
+
+        int n1 = 0;
+        for (int i = 0; i < n; i++) {
+            if (isLMS(sa[i])) {
+                sa[n1++] = sa[i];
+            }
+        }
+
+        // Name LMS substrings; equal substrings share a name.
+        std::fill(sa + n1, sa + n, -1);
+        int name = 0;
+        int prev = -1;
+        for (int i = 0; i < n1; i++) {
+            int pos = sa[i];
+            bool diff = false;
+            for (int d = 0; ; d++) {
+                if (prev == -1 || s[pos + d] != s[prev + d] || stype[pos + d] != stype[prev + d]) {
+                    diff = true;
+                    break;
+                }
+                if (d > 0 && (isLMS(pos + d) || isLMS(prev + d))) {
+                    break;
+                }
+            }
+            if (diff) {
+                name++;
+                prev = pos;
+            }
+            sa[n1 + pos / 2] = name - 1;
+        }
+        for (int i = n - 1, j = n - 1; i >= n1; i--) {
+            if (sa[i] >= 0) {
+                sa[j--] = sa[i];
+            }
+        }
+
+        // Sort the reduced problem, recursing only when names repeat.
+        int* s1 = sa + n - n1;
+        if (name < n1) {
+            sais(s1, sa, n1, name);
+        } else {
+            for (int i = 0; i < n1; i++) {
+                sa[s1[i]] = i;
+            }
+        }
+
+        // Induce the full suffix array from the sorted LMS suffixes.
+        getBuckets(s, n, k, bucket, true);
+        for (int i = 1, j = 0; i < n; i++) {
+            if (isLMS(i)) {
+                s1[j++] = i;
+            }
+        }
+        for (int i = 0; i < n1; i++) {
+            sa[i] = s1[sa[i]];
+        }
+        std::fill(sa + n1, sa + n, -1);
+        for (int i = n1 - 1; i >= 0; i--) {
+            int j = sa[i];
+            sa[i] = -1;
+            sa[--bucket[s[j]]] = j;
+        }
+        induce(s, sa, n, k, stype, bucket);
+    }
+
+    static std::vector<uint8_t> encodeBlock(const uint8_t* data, size_t length) {
+        ArenaScope scope;
+        int n = static_cast<int>(length);
+        ArenaVector<int> text(n + 1);
+        for (int i = 0; i < n; i++) {
+            text[i] = data[i] + 1;
+        }
+        text[n] = 0;
+
+        ArenaVector<int> sa(n + 1);
+        {
+            PhaseTimer timer("bwt.sort", length);
+            sais(text.data(), sa.data(), n + 1, 257);
+        }
+
+        PhaseTimer timer("bwt.mtf", length);
+
+        // Last column without the sentinel; primary is the sentinel's row.
+        ArenaVector<uint8_t> last;
+        last.reserve(n);
+        uint32_t primary = 0;
+        for (int i = 0; i <= n; i++) {
+            if (sa[i] == 0) {
+                primary = static_cast<uint32_t>(i);
+            } else {
+                last.push_back(data[sa[i] - 1]);
+            }
+        }
+
+        ArenaVector<uint8_t> encoded;
+        encoded.reserve(length / 2 + 16);
+        std::array<uint8_t, 256> order;
+        for (int i = 0; i < 256; i++) {
+            order[i] = static_cast<uint8_t>(i);
+        }
+
+        size_t zero_run = 0;
+        auto flushRun = [&]() {
+            while (zero_run > 0) {
+                encoded.push_back(((zero_run - 1) & 1) ? RUNB : RUNA);
+                zero_run = (zero_run - 1) >> 1;
+            }
+        };
+
+        for (uint8_t byte : last) {
+            int index = 0;
+            while (order[index] != byte) {
+                index++;
+            }
+            if (index == 0) {
+                zero_run++;
+                continue;
+            }
+            flushRun();
+            std::move_backward(order.begin(), order.begin() + index, order.begin() + index + 1);
+            order[0] = byte;
+            if (index + 1 < ESCAPE) {
+                encoded.push_back(static_cast<uint8_t>(index + 1));
+            } else {
+                encoded.push_back(ESCAPE);
+                encoded.push_back(static_cast<uint8_t>(index - 254));
+            }
+        }
+        flushRun();
+
+        std::vector<uint8_t> block;
+        block.reserve(12 + encoded.size());
+        writeUint32(block, static_cast<uint32_t>(length));
+        writeUint32(block, primary);
+        writeUint32(block, static_cast<uint32_t>(encoded.size()));
+        block.insert(block.end(), encoded.begin(), encoded.end());
+        return block;
+    }
+
+    static void decodeBlock(const uint8_t* encoded, size_t encoded_size, uint32_t primary,
+                            uint8_t* out, size_t length) {
+        PhaseTimer timer("bwt.decode", length);
+        ArenaScope scope;
+        // Undo zero-run coding and move-to-front into the last column.
+        ArenaVector<uint8_t> last;
+        last.reserve(length);
+        std::array<uint8_t, 256> order;
+        for (int i = 0; i < 256; i++) {
+            order[i] = static_cast<uint8_t>(i);
+        }
+
+        size_t zero_run = 0;
+        size_t weight = 1;
+        for (size_t i = 0; i < encoded_size; i++) {
+            uint8_t symbol = encoded[i];
+            if (symbol == RUNA || symbol == RUNB) {
+                zero_run += weight * (symbol == RUNA ? 1 : 2);
+                weight <<= 1;
+                if (zero_run > length) {
+                    throw std::runtime_error("Corrupted BWT zero run");
+                }
+                continue;
+            }
+            last.insert(last.end(), zero_run, order[0]);
+            zero_run = 0;
+            weight = 1;
+
+            int index = symbol - 1;
+            if (symbol == ESCAPE) {
+                if (++i >= encoded_size) {
+                    throw std::runtime_error("Truncated BWT escape");
+                }
+                if (encoded[i] > 1) {
+                    throw std::runtime_error("Corrupted BWT escape");
+                }
+                index = 254 + encoded[i];
+            }
+            uint8_t byte = order[index];
+            std::move_backward(order.begin(), order.begin() + index, order.begin() + index + 1);
+            order[0] = byte;
+            last.push_back(byte);
+        }
+        last.insert(last.end(), zero_run, order[0]);
+
+        if (last.size() != length) {
+            throw std::runtime_error("Corrupted BWT block length");
+        }
+        if (length == 0) {
+            return;
+        }
+
+        // Invert through the LF mapping; row `primary` holds the sentinel,
+        // which sorts before every byte.
+        std::array<uint32_t, 256> first{};
+        for (uint8_t byte : last) {
+            first[byte]++;
+        }
+        uint32_t sum = 1;
+        for (int c = 0; c < 256; c++) {
+            uint32_t count = first[c];
+            first[c] = sum;
+            sum += count;
+        }
+
+        ArenaVector<uint32_t> lf(length + 1);
+        for (size_t row = 0, i = 0; row <= length; row++) {
+            if (row == primary) {
+                continue;
+            }
+            lf[row] = first[last[i++]]++;
+        }
+
+        auto lastAt = [&](size_t row) { return last[row < primary ? row : row - 1]; };
+        size_t row = 0;
+        for (size_t k = length; k-- > 0; ) {
+            out[k] = lastAt(row);
+            row = lf[row];
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef BYTES_HPP
+#define BYTES_HPP
+
+#include <cstdint>
+#include <vector>
+
+// Little-endian integer helpers shared by the container and codec framings.
+
+inline void writeUint32(std::vector<uint8_t>& data, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        data.push_back(static_cast<uint8_t>(value & 0xFF));
+        value >>= 8;
+    }
+}
+
+inline void writeUint64(std::vector<uint8_t>& data, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        data.push_back(static_cast<uint8_t>(value & 0xFF));
+        value >>= 8;
+    }
+}
+
+inline uint32_t readUint32(const uint8_t* data) {
+    return static_cast<uint32_t>(data[0]) |
+           (static_cast<uint32_t>(data[1]) << 8) |
+           (static_cast<uint32_t>(data[2]) << 16) |
+           (static_cast<uint32_t>(data[3]) << 24);
+}
+
+inline uint32_t readUint32(const std::vector<uint8_t>& data, size_t offset) {
+    return readUint32(data.data() + offset);
+}
+
+inline uint64_t readUint64(const uint8_t* data) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+inline uint64_t readUint64(const std::vector<uint8_t>& data, size_t offset) {
+    return readUint64(data.data() + offset);
+}
+
+#endif
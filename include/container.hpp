@@ -0,0 +1,594 @@
+#ifndef CONTAINER_HPP
+#define CONTAINER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "analyzer.hpp"
+#include "bytes.hpp"
+#include "executor.hpp"
+#include "file_io.hpp"
+#include "pipeline.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+// Block-framed file format. Every block records how it was encoded, so one
+// file can mix codecs and decoding dispatches per block.
+//
+//   header: "FCMP" | u8 version | u64 original size
+//           | u8 stage count | (u8 stage id, u8 option)*
+//           (the size is all ones when the input's length was unknown;
+//           the pipeline is the one requested, zero stages when chosen
+//           per block)
+//   block:  u32 raw size | u32 payload size | u8 kind | ...
+//             kind 0:      stored, payload is the raw bytes
+//             kind 1-254:  that many (u8 stage id, u8 option), then payload
+//             kind 255:    constant, payload is the single repeated byte
+//   end:    u32 0 | u32 0
+//
+// Version 1 blocks carried no kind and always used the header's stages;
+// version 2 had no constant blocks; before version 4 the header carried no
+// original size.
+//
+// Given a PositionalFile, output skips the stream and its final in-order
+// write: decoded blocks go straight to their offsets (the sum of the raw
+// sizes before them) from the workers, each block's range reserved just
+// before it is written. Encoded blocks are placed in sequence as they
+// finish and written by their workers (see BlockPlacement). The bytes are
+// the same either way.
+struct StreamTotals {
+    uint64_t input_bytes = 0;
+    uint64_t output_bytes = 0;
+    std::map<std::string, uint64_t> blocks_by_pipeline;
+};
+
+class Container {
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+    // Level 9's. Larger frames are corrupt, which bounds what a single
+    // block, constant ones included, can make the decoder allocate.
+    static constexpr size_t MAX_BLOCK_SIZE = 8 << 20;
+    static constexpr uint8_t VERSION = 4;
+    static constexpr uint64_t UNKNOWN_SIZE = UINT64_MAX;
+
+    static bool hasHeader(std::istream& in) {
+        char magic[4] = {};
+        auto start = in.tellg();
+        in.read(magic, sizeof(magic));
+        bool found = in.gcount() == 4 && std::string(magic, 4) == MAGIC;
+        in.clear();
+        in.seekg(start);
+        return found;
+    }
+
+    // Encodes every block with `pipeline`. With `threads` other than 1,
+    // reading, coding and writing overlap (see BlockExecutor) and workers
+    // are placed by `numa`; the output is the same bytes either way. With
+    // `positional`, output goes there rather than to `out`.
+    static StreamTotals compress(std::istream& in, std::ostream& out, const Pipeline& pipeline,
+                                 size_t block_size = DEFAULT_BLOCK_SIZE, unsigned threads = 1,
+                                 NumaPolicy numa = NumaPolicy::Off, PositionalFile* positional = nullptr) {
+        return compressBlocks(in, out, positional, pipeline.specs(), block_size, threads, numa,
+                              [&](const std::vector<uint8_t>&, const SampleStats&, PipelineCache&) -> const Pipeline& {
+                                  return pipeline;
+                              });
+    }
+
+    // Picks a pipeline (or stored) for each block independently.
+    static StreamTotals compressAdaptive(std::istream& in, std::ostream& out, const CompressionLevel& level,
+                                         unsigned threads = 1, NumaPolicy numa = NumaPolicy::Off,
+                                         PositionalFile* positional = nullptr) {
+        return compressBlocks(in, out, positional, {}, level.block_size, threads, numa,
+                              [&](const std::vector<uint8_t>& raw, const SampleStats& stats,
+                                  PipelineCache& pipelines) -> const Pipeline& {
+                                  return pipelines.get(
+                                      Analyzer::chooseBlock(raw.data(), raw.size(), stats, level, pipelines));
+                              });
+    }
+
+    static StreamTotals decompress(std::istream& in, std::ostream& out, unsigned threads = 1,
+                                   NumaPolicy numa = NumaPolicy::Off, PositionalFile* positional = nullptr) {
+        StreamTotals totals;
+
+        std::vector<uint8_t> header(5);
+        readBytes(in, header);
+        if (std::string(header.begin(), header.begin() + 4) != MAGIC) {
+            throw std::runtime_error("Not a compressed container");
+        }
+        uint8_t version = header[4];
+        if (version < 1 || version > VERSION) {
+            throw std::runtime_error("Unsupported container version");
+        }
+        totals.input_bytes += header.size();
+        uint64_t original_size = UNKNOWN_SIZE;
+        if (version >= 4) {
+            std::vector<uint8_t> size(8);
+            readBytes(in, size);
+            totals.input_bytes += size.size();
+            original_size = readUint64(size, 0);
+        }
+        std::vector<StageSpec> header_specs = readStageList(in, readKind(in, totals), totals);
+        uint64_t output_offset = 0;
+
+        // Every block but the last is full, so the first one's size gives
+        // the count.
+        uint64_t blocks = UNKNOWN_SIZE;
+        if (original_size != UNKNOWN_SIZE) {
+            uint32_t block_size = peekRawSize(in);
+            if (block_size > 0) {
+                blocks = (original_size + block_size - 1) / block_size;
+            }
+        }
+
+        // Block sizes are only known as frames arrive; placed buffers are
+        // sized for the default block and grow wherever the reader runs.
+        runBlocks<DecodeJob>(
+            threads, blocks, Pipeline(header_specs).threaded(false), numa,
+            [&](DecodeJob& job) {
+                job.payload.resize(DEFAULT_BLOCK_SIZE);
+                job.decoded.resize(DEFAULT_BLOCK_SIZE);
+            },
+            [&](DecodeJob& job, int64_t index) {
+                TraceSpan span("read", index);
+                job.frame.resize(8);
+                readBytes(in, job.frame);
+                totals.input_bytes += job.frame.size();
+                job.raw_size = readUint32(job.frame, 0);
+                uint32_t payload_size = readUint32(job.frame, 4);
+                if (job.raw_size == 0 && payload_size == 0) {
+                    return false;
+                }
+                if (job.raw_size > MAX_BLOCK_SIZE) {
+                    throw std::runtime_error("Corrupted block: size too large");
+                }
+                job.offset = output_offset;
+                output_offset += job.raw_size;
+
+                job.kind = version == 1 ? static_cast<uint8_t>(header_specs.size()) : readKind(in, totals);
+                job.specs.clear();
+                if (job.kind != CONSTANT) {
+                    job.specs = version == 1 ? header_specs : readStageList(in, job.kind, totals);
+                }
+                readPayload(in, job.payload, payload_size);
+                totals.input_bytes += payload_size;
+                span.setBytes(payload_size);
+                return true;
+            },
+            [&](DecodeJob& job, int64_t index, WorkerState& worker) {
+                decodeJob(job, index, worker);
+                if (positional) {
+                    TraceSpan span("write", index, job.raw_size);
+                    positional->reserve(job.offset, job.raw_size);
+                    writeAt(*positional, job.offset, *job.block);
+                }
+            },
+            [&](DecodeJob& job, int64_t index) {
+                if (positional) {
+                    totals.output_bytes += job.raw_size;
+                } else {
+                    TraceSpan span("write", index, job.raw_size);
+                    totals.output_bytes += writeBytes(out, *job.block);
+                }
+                totals.blocks_by_pipeline[job.description]++;
+            });
+        if (original_size != UNKNOWN_SIZE && totals.output_bytes != original_size) {
+            throw std::runtime_error("Corrupted container: size mismatch");
+        }
+        if (positional) {
+            positional->truncate(totals.output_bytes);
+        }
+        return totals;
+    }
+
+private:
+    static constexpr const char* MAGIC = "FCMP";
+    static constexpr uint8_t STORED = 0;
+    static constexpr uint8_t CONSTANT = 255;
+
+    // One block's buffers. Jobs are reused from block to block, so the
+    // buffers stop reallocating once they reach the block size.
+    struct EncodeJob {
+        std::vector<uint8_t> raw;
+        std::vector<uint8_t> encoded;
+        std::vector<uint8_t> frame;
+        const std::vector<uint8_t>* payload = nullptr;
+        std::string description;
+        std::atomic<bool> written{false};  // by BlockPlacement
+    };
+
+    struct DecodeJob {
+        std::vector<uint8_t> frame;
+        std::vector<uint8_t> payload;
+        std::vector<uint8_t> decoded;
+        std::vector<StageSpec> specs;
+        uint8_t kind = STORED;
+        uint32_t raw_size = 0;
+        uint64_t offset = 0;  // in the output
+        const std::vector<uint8_t>* block = nullptr;
+        std::string description;
+    };
+
+    // What a worker keeps between blocks, whichever blocks it runs: built
+    // pipelines, the stages' intermediate buffer and how many threads the
+    // stages may use. Codec scratch comes from the thread's own arena.
+    struct WorkerState {
+        PipelineCache pipelines;
+        std::vector<uint8_t> scratch;
+        unsigned threads = 1;
+    };
+
+    // Constant and incompressible blocks skip the codecs entirely. The
+    // block is sampled once, for both that check and the chooser.
+    template <typename Chooser>
+    static void encodeJob(EncodeJob& job, int64_t index, WorkerState& worker, const Pipeline& stored,
+                          Chooser& choose) {
+        const std::vector<uint8_t>& raw = job.raw;
+        TraceSpan span("compress", index, raw.size());
+        job.payload = &job.encoded;
+        job.frame.clear();
+        writeUint32(job.frame, static_cast<uint32_t>(raw.size()));
+        if (isConstant(raw)) {
+            job.encoded.assign(1, raw[0]);
+            writeUint32(job.frame, 1);
+            job.frame.push_back(CONSTANT);
+            job.description = "constant";
+            return;
+        }
+        const Pipeline* pipeline = &stored;
+        SampleStats stats = Analyzer::sample(raw.data(), raw.size());
+        if (!Analyzer::isIncompressible(stats)) {
+            pipeline = &choose(raw, stats, worker.pipelines);
+            pipeline->encodeBlock(raw, job.encoded, worker.scratch, worker.threads);
+            if (job.encoded.size() >= raw.size()) {
+                pipeline = &stored;
+            }
+        }
+        if (pipeline == &stored) {
+            job.payload = &raw;
+        }
+        writeUint32(job.frame, static_cast<uint32_t>(job.payload->size()));
+        appendStageList(job.frame, pipeline->specs());
+        job.description = pipeline->describe();
+    }
+
+    // Points job.block at the decoded bytes; stored payloads are used as
+    // they are, without a copy.
+    static void decodeJob(DecodeJob& job, int64_t index, WorkerState& worker) {
+        TraceSpan span("decompress", index, job.raw_size);
+        job.block = &job.payload;
+        if (job.kind == CONSTANT) {
+            if (job.payload.size() != 1) {
+                throw std::runtime_error("Corrupted constant block");
+            }
+            job.decoded.assign(job.raw_size, job.payload[0]);
+            job.block = &job.decoded;
+            job.description = "constant";
+        } else {
+            const Pipeline& pipeline = worker.pipelines.get(job.specs);
+            if (job.kind != STORED) {
+                pipeline.decodeBlock(job.payload, job.decoded, worker.scratch, worker.threads);
+                job.block = &job.decoded;
+            }
+            job.description = pipeline.describe();
+        }
+        if (job.block->size() != job.raw_size) {
+            throw std::runtime_error("Corrupted block: size mismatch");
+        }
+    }
+
+    // Runs read/process/write for every block: inline on the caller for one
+    // thread, else through a BlockExecutor with `threads` workers. With a
+    // NUMA policy, each block's buffers are first sized by `place` on the
+    // worker that owns them, so their pages sit on that worker's node.
+    //
+    // With fewer `blocks` (UNKNOWN_SIZE if not known) than workers, some
+    // workers would sit idle, so each block's codecs get a share of the
+    // threads. When every stage splits blocks over threads (`threaded`),
+    // the blocks instead run inline, one at a time with all of them.
+    template <typename Job, typename Place, typename Read, typename Process, typename Write>
+    static void runBlocks(unsigned threads, uint64_t blocks, bool threaded, NumaPolicy numa, Place place,
+                          Read read, Process process, Write write) {
+        unsigned workers = Parallel::resolve(threads);
+        bool few_blocks = blocks < workers;
+        if (workers <= 1 || (few_blocks && threaded)) {
+            Job job;
+            WorkerState state;
+            state.threads = workers;
+            for (int64_t index = 0; read(job, index); index++) {
+                process(job, index, state);
+                write(job, index);
+            }
+            return;
+        }
+
+        std::vector<WorkerState> states(workers);
+        if (few_blocks) {
+            for (WorkerState& state : states) {
+                state.threads = static_cast<unsigned>(workers / std::max<uint64_t>(blocks, 1));
+            }
+        }
+        BlockExecutor<Job>::run(
+            workers, 2 * workers + 2, numa,
+            [&](Job& job, unsigned) {
+                if (numa != NumaPolicy::Off) {
+                    place(job);
+                }
+            },
+            [&](Job& job, uint64_t sequence) { return read(job, static_cast<int64_t>(sequence)); },
+            [&](Job& job, uint64_t sequence, unsigned worker) {
+                process(job, static_cast<int64_t>(sequence), states[worker]);
+            },
+            [&](Job& job, uint64_t sequence) { write(job, static_cast<int64_t>(sequence)); });
+    }
+
+    // Gives encoded blocks their offsets in a positional output. Offsets
+    // depend on the sizes of all earlier blocks, so they are handed out in
+    // sequence, but blocks finish in any order: one that finishes early is
+    // parked, and the worker that finishes its predecessor places both and
+    // writes them. Only that bookkeeping is serial; the writes themselves
+    // run on the workers, side by side.
+    class BlockPlacement {
+    public:
+        BlockPlacement(PositionalFile& file, uint64_t offset) : file_(file), offset_(offset) {}
+
+        // Called by the worker that encoded block `index`.
+        void place(EncodeJob& job, int64_t index) {
+            std::vector<Placed> placed;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                parked_[index] = &job;
+                auto next = parked_.begin();
+                while (next != parked_.end() && next->first == next_) {
+                    EncodeJob* ready = next->second;
+                    placed.push_back({ready, next_++, offset_});
+                    offset_ += ready->frame.size() + ready->payload->size();
+                    next = parked_.erase(next);
+                }
+            }
+            try {
+                for (const Placed& block : placed) {
+                    EncodeJob& ready = *block.job;
+                    uint64_t length = ready.frame.size() + ready.payload->size();
+                    TraceSpan span("write", block.index, length);
+                    file_.reserve(block.offset, length);
+                    writeAt(file_, block.offset, ready.frame);
+                    writeAt(file_, block.offset + ready.frame.size(), *ready.payload);
+                    ready.written.store(true, std::memory_order_release);
+                }
+            } catch (...) {
+                failed_.store(true, std::memory_order_release);
+                throw;
+            }
+        }
+
+        // Called in sequence order before a block's buffers are reused. A
+        // block reaching here has been placed, so this only waits out its
+        // write.
+        void waitWritten(EncodeJob& job) {
+            Backoff backoff;
+            while (!job.written.load(std::memory_order_acquire)) {
+                if (failed_.load(std::memory_order_acquire)) {
+                    throw std::runtime_error("Write failed");
+                }
+                backoff.pause();
+            }
+            job.written.store(false, std::memory_order_relaxed);
+        }
+
+        // Where the end marker goes, once every block is placed.
+        uint64_t end() const { return offset_; }
+
+    private:
+        struct Placed {
+            EncodeJob* job;
+            int64_t index;
+            uint64_t offset;
+        };
+
+        PositionalFile& file_;
+        std::mutex mutex_;
+        std::map<int64_t, EncodeJob*> parked_;
+        int64_t next_ = 0;
+        uint64_t offset_;
+        std::atomic<bool> failed_{false};
+    };
+
+    template <typename Chooser>
+    static StreamTotals compressBlocks(std::istream& in, std::ostream& out, PositionalFile* positional,
+                                       const std::vector<StageSpec>& header_specs, size_t block_size,
+                                       unsigned threads, NumaPolicy numa, Chooser choose) {
+        if (block_size == 0 || block_size > MAX_BLOCK_SIZE) {
+            throw std::runtime_error("Invalid block size");
+        }
+        StreamTotals totals;
+
+        uint64_t original_size = remainingSize(in);
+        std::vector<uint8_t> header(MAGIC, MAGIC + 4);
+        header.push_back(VERSION);
+        writeUint64(header, original_size);
+        appendStageList(header, header_specs);
+        std::unique_ptr<BlockPlacement> placement;
+        if (positional) {
+            writeAt(*positional, 0, header);
+            totals.output_bytes += header.size();
+            placement.reset(new BlockPlacement(*positional, header.size()));
+        } else {
+            totals.output_bytes += writeBytes(out, header);
+        }
+
+        const Pipeline stored({});
+        uint64_t blocks = UNKNOWN_SIZE;
+        if (original_size != UNKNOWN_SIZE) {
+            blocks = (original_size + block_size - 1) / block_size;
+        }
+        runBlocks<EncodeJob>(
+            threads, blocks, Pipeline(header_specs).threaded(true), numa,
+            [&](EncodeJob& job) {
+                job.raw.resize(block_size);
+                job.encoded.resize(block_size);
+            },
+            [&](EncodeJob& job, int64_t index) {
+                PhaseTimer timer("read");
+                TraceSpan span("read", index);
+                job.raw.resize(block_size);
+                in.read(reinterpret_cast<char*>(job.raw.data()), block_size);
+                size_t length = static_cast<size_t>(in.gcount());
+                timer.setBytes(length);
+                span.setBytes(length);
+                job.raw.resize(length);
+                totals.input_bytes += length;
+                return length > 0;
+            },
+            [&](EncodeJob& job, int64_t index, WorkerState& worker) {
+                encodeJob(job, index, worker, stored, choose);
+                if (placement) {
+                    placement->place(job, index);
+                }
+            },
+            [&](EncodeJob& job, int64_t index) {
+                if (placement) {
+                    placement->waitWritten(job);
+                    totals.output_bytes += job.frame.size() + job.payload->size();
+                } else {
+                    TraceSpan span("write", index, job.frame.size() + job.payload->size());
+                    totals.output_bytes += writeBytes(out, job.frame);
+                    totals.output_bytes += writeBytes(out, *job.payload);
+                }
+                totals.blocks_by_pipeline[job.description]++;
+            });
+
+        std::vector<uint8_t> frame;
+        writeUint32(frame, 0);
+        writeUint32(frame, 0);
+        if (positional) {
+            writeAt(*positional, placement->end(), frame);
+            totals.output_bytes += frame.size();
+            positional->truncate(totals.output_bytes);
+        } else {
+            totals.output_bytes += writeBytes(out, frame);
+        }
+        return totals;
+    }
+
+    static void appendStageList(std::vector<uint8_t>& data, const std::vector<StageSpec>& specs) {
+        data.push_back(static_cast<uint8_t>(specs.size()));
+        for (const StageSpec& spec : specs) {
+            data.push_back(static_cast<uint8_t>(spec.id));
+            data.push_back(spec.option);
+        }
+    }
+
+    static bool isConstant(const std::vector<uint8_t>& data) {
+        return std::all_of(data.begin(), data.end(), [&](uint8_t byte) { return byte == data[0]; });
+    }
+
+    static uint8_t readKind(std::istream& in, StreamTotals& totals) {
+        std::vector<uint8_t> kind(1);
+        readBytes(in, kind);
+        totals.input_bytes += kind.size();
+        return kind[0];
+    }
+
+    static std::vector<StageSpec> readStageList(std::istream& in, uint8_t count, StreamTotals& totals) {
+        if (count == CONSTANT) {
+            throw std::runtime_error("Unexpected constant block marker");
+        }
+        std::vector<uint8_t> entries(2 * count);
+        readBytes(in, entries);
+        totals.input_bytes += entries.size();
+
+        std::vector<StageSpec> specs;
+        for (size_t i = 0; i < entries.size(); i += 2) {
+            specs.emplace_back(static_cast<StageId>(entries[i]), entries[i + 1]);
+        }
+        return specs;
+    }
+
+    // The raw size in the next block frame, left unread; 0 for the end
+    // marker or unseekable input.
+    static uint32_t peekRawSize(std::istream& in) {
+        std::streampos start = in.tellg();
+        if (start == std::streampos(-1)) {
+            in.clear();
+            return 0;
+        }
+        std::vector<uint8_t> size(4);
+        in.read(reinterpret_cast<char*>(size.data()), size.size());
+        bool complete = in.gcount() == 4;
+        in.clear();
+        in.seekg(start);
+        return complete ? readUint32(size, 0) : 0;
+    }
+
+    // Bytes left in `in` from its current position, or UNKNOWN_SIZE for
+    // pipes and other unseekable input.
+    static uint64_t remainingSize(std::istream& in) {
+        std::streampos start = in.tellg();
+        if (start == std::streampos(-1)) {
+            in.clear();
+            return UNKNOWN_SIZE;
+        }
+        in.seekg(0, std::ios::end);
+        std::streampos end = in.tellg();
+        in.clear();
+        in.seekg(start);
+        if (end == std::streampos(-1) || end < start) {
+            return UNKNOWN_SIZE;
+        }
+        return static_cast<uint64_t>(end - start);
+    }
+
+    static void writeAt(PositionalFile& file, uint64_t offset, const std::vector<uint8_t>& data) {
+        PhaseTimer timer("write", data.size());
+        file.writeAt(offset, data.data(), data.size());
+    }
+
+    static size_t writeBytes(std::ostream& out, const std::vector<uint8_t>& data) {
+        PhaseTimer timer("write", data.size());
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!out) {
+            throw std::runtime_error("Write failed");
+        }
+        return data.size();
+    }
+
+    // Reads a `size`-byte payload into `data`, growing it only as bytes
+    // arrive: the size comes from the frame, and a forged one must not
+    // allocate more than about twice what the input actually holds.
+    static void readPayload(std::istream& in, std::vector<uint8_t>& data, uint32_t size) {
+        PhaseTimer timer("read", size);
+        data.resize(std::min<size_t>(size, std::max(data.capacity(), DEFAULT_BLOCK_SIZE)));
+        size_t done = 0;
+        while (true) {
+            size_t wanted = data.size() - done;
+            in.read(reinterpret_cast<char*>(data.data() + done), wanted);
+            if (static_cast<size_t>(in.gcount()) != wanted) {
+                throw std::runtime_error("Truncated container");
+            }
+            done = data.size();
+            if (done == size) {
+                return;
+            }
+            data.resize(std::min<size_t>(size, 2 * done));
+        }
+    }
+
+    static void readBytes(std::istream& in, std::vector<uint8_t>& data) {
+        PhaseTimer timer("read", data.size());
+        in.read(reinterpret_cast<char*>(data.data()), data.size());
+        if (static_cast<size_t>(in.gcount()) != data.size()) {
+            throw std::runtime_error("Truncated container");
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "numa.hpp"
+#include "parallel.hpp"
+#include "queue.hpp"
+#include "trace.hpp"
+
+// Overlaps reading, coding and writing of a stream of numbered blocks. A
+// reader thread fills blocks, worker threads code them in any order, and
+// the calling thread writes them back in sequence:
+//
+//   reader --run queues--> workers --done (MPMC)--> writer
+//      ^                                               |
+//      +-------------- free blocks (SPSC) -------------+
+//
+// A fixed set of blocks circulates, so buffers are reused once they have
+// grown to the block size and at most `in_flight` blocks are ever held:
+// when the writer falls behind the reader runs out of free blocks and
+// waits. With the disk and the codecs busy at once, wall time tends to
+// max(I/O, CPU) rather than their sum.
+//
+// Block costs vary by two orders of magnitude between codecs and data, so
+// work is scheduled by stealing: the reader deals each block to the run
+// queue of the worker that owns its buffers (blocks are shared out
+// round-robin), a worker takes from its own queue first, and an
+// idle worker steals from the others rather than waiting. Both owner and
+// thieves take the oldest block, which keeps the writer's next block
+// moving; per-worker state indexed by `worker` stays with the thread that
+// runs a block, stolen or not.
+template <typename Block>
+class BlockExecutor {
+public:
+    // prepare(block, worker) runs once per block on the worker that owns
+    // it, before any input is read, so buffers it sizes are first touched
+    // there; read(block, sequence) fills a block and returns false at the
+    // end of the input; process(block, sequence, worker) codes it on worker
+    // thread `worker`; write(block, sequence) is called in sequence order.
+    // The first exception from any of them stops the others and is
+    // rethrown. Workers are placed according to `numa` (see Numa::place).
+    template <typename Prepare, typename Read, typename Process, typename Write>
+    static void run(unsigned workers, size_t in_flight, NumaPolicy numa, Prepare prepare, Read read,
+                    Process process, Write write) {
+        workers = Parallel::resolve(workers);
+        in_flight = std::max<size_t>(in_flight, 1);
+
+        std::unique_ptr<Slot[]> slots(new Slot[in_flight]);
+        SpscQueue<Slot*> free_slots(in_flight);
+        std::vector<std::unique_ptr<MpmcQueue<Slot*>>> queues;
+        for (unsigned worker = 0; worker < workers; worker++) {
+            queues.emplace_back(new MpmcQueue<Slot*>(in_flight));
+        }
+        MpmcQueue<Slot*> done(in_flight);
+
+        Failure failure;
+        std::atomic<unsigned> ready{0};
+        std::atomic<uint64_t> total{UINT64_MAX};
+        std::vector<std::thread> threads;
+        for (unsigned worker = 0; worker < workers; worker++) {
+            threads.emplace_back([&, worker]() {
+                nameThread("worker " + std::to_string(worker));
+                failure.guard([&]() {
+                    Numa::place(numa, worker);
+                    for (size_t i = worker; i < in_flight; i += workers) {
+                        slots[i].home = worker;
+                        prepare(slots[i].block, worker);
+                    }
+                    ready.fetch_add(1, std::memory_order_release);
+
+                    Slot* slot = nullptr;
+                    while (wait(failure, [&] { return take(queues, worker, total, slot); }) && slot) {
+                        process(slot->block, slot->sequence, worker);
+                        wait(failure, [&] { return done.tryPush(slot); });
+                    }
+                });
+            });
+        }
+
+        // The reader starts once every block has been prepared.
+        if (wait(failure, [&] { return ready.load(std::memory_order_acquire) == workers; })) {
+            for (size_t i = 0; i < in_flight; i++) {
+                free_slots.tryPush(&slots[i]);
+            }
+            threads.emplace_back([&]() {
+                nameThread("reader");
+                failure.guard([&]() {
+                    uint64_t sequence = 0;
+                    Slot* slot = nullptr;
+                    while (wait(failure, [&] { return free_slots.tryPop(slot); })) {
+                        if (!read(slot->block, sequence)) {
+                            break;
+                        }
+                        // Blocks go back to the worker holding their buffers.
+                        // Every queue can hold all the blocks, so this never
+                        // waits.
+                        slot->sequence = sequence++;
+                        queues[slot->home]->tryPush(slot);
+                    }
+                    total.store(sequence, std::memory_order_release);
+                });
+            });
+        }
+
+        // Blocks finish out of order; at most `in_flight` are outstanding,
+        // so sequence % in_flight gives each a distinct parking place.
+        failure.guard([&]() {
+            std::vector<Slot*> pending(in_flight, nullptr);
+            uint64_t next = 0;
+            Slot* slot = nullptr;
+            while (wait(failure, [&] {
+                return next == total.load(std::memory_order_acquire) || done.tryPop(slot);
+            })) {
+                if (next == total.load(std::memory_order_acquire)) {
+                    break;
+                }
+                pending[slot->sequence % in_flight] = slot;
+                while ((slot = pending[next % in_flight]) != nullptr) {
+                    pending[next % in_flight] = nullptr;
+                    write(slot->block, next++);
+                    free_slots.tryPush(slot);
+                }
+            }
+        });
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        failure.rethrow();
+    }
+
+private:
+    struct Slot {
+        Block block;
+        uint64_t sequence = 0;
+        unsigned home = 0;  // worker that prepared the block's buffers
+    };
+
+    class Failure {
+    public:
+        template <typename Fn>
+        void guard(Fn fn) {
+            try {
+                fn();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+                failed_.store(true, std::memory_order_release);
+            }
+        }
+
+        bool failed() const { return failed_.load(std::memory_order_acquire); }
+
+        void rethrow() {
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+        }
+
+    private:
+        std::atomic<bool> failed_{false};
+        std::mutex mutex_;
+        std::exception_ptr error_;
+    };
+
+    // Pops the worker's own queue, else steals from the others starting
+    // with its neighbour. Sets `slot` to null once the reader has finished
+    // and every queue is empty: all pushes precede the store to `total`,
+    // so nothing can arrive after that.
+    static bool take(const std::vector<std::unique_ptr<MpmcQueue<Slot*>>>& queues, unsigned worker,
+                     const std::atomic<uint64_t>& total, Slot*& slot) {
+        bool finished = total.load(std::memory_order_acquire) != UINT64_MAX;
+        size_t count = queues.size();
+        for (size_t i = 0; i < count; i++) {
+            if (queues[(worker + i) % count]->tryPop(slot)) {
+                return true;
+            }
+        }
+        slot = nullptr;
+        return finished;
+    }
+
+    // Retries `attempt` until it succeeds (true) or another thread has
+    // failed (false).
+    template <typename Attempt>
+    static bool wait(const Failure& failure, Attempt attempt) {
+        Backoff backoff;
+        while (!attempt()) {
+            if (failure.failed()) {
+                return false;
+            }
+            backoff.pause();
+        }
+        return true;
+    }
+
+    static void nameThread(const std::string& name) {
+        if (Trace::enabled()) {
+            Trace::setThreadName(name);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,654 @@
+#ifndef FILE_IO_HPP
+#define FILE_IO_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "uring.hpp"
+
+// How files are read and written.
+//   uring:  several block reads and writes in flight through io_uring,
+//           falling back to pread/pwrite where io_uring is unavailable
+//   pread:  pread/pwrite, one request at a time
+//   stream: std::ifstream/std::ofstream
+enum class IoMode { Uring, Pread, Stream };
+
+class FileIo {
+public:
+    static IoMode parseMode(const std::string& name) {
+        if (name == "uring") return IoMode::Uring;
+        if (name == "pread") return IoMode::Pread;
+        if (name == "stream") return IoMode::Stream;
+        throw std::runtime_error("Unknown I/O mode: " + name);
+    }
+
+    // Opens with O_DIRECT when asked and the filesystem allows it, else
+    // without.
+    static int openFile(const std::string& path, int flags, bool direct) {
+#ifdef O_DIRECT
+        if (direct) {
+            int fd = open(path.c_str(), flags | O_DIRECT, 0644);
+            if (fd >= 0 || errno != EINVAL) {
+                return fd;
+            }
+        }
+#endif
+        (void)direct;
+        return open(path.c_str(), flags, 0644);
+    }
+
+    static bool isDirect(int fd) {
+#ifdef O_DIRECT
+        int flags = fcntl(fd, F_GETFL);
+        return flags >= 0 && (flags & O_DIRECT) != 0;
+#else
+        (void)fd;
+        return false;
+#endif
+    }
+
+    // Whether both paths name one existing file, under any name. Output is
+    // truncated when opened, before input is read, so such a pair must be
+    // refused.
+    static bool sameFile(const std::string& first, const std::string& second) {
+        struct stat a;
+        struct stat b;
+        return stat(first.c_str(), &a) == 0 && stat(second.c_str(), &b) == 0 && a.st_dev == b.st_dev &&
+               a.st_ino == b.st_ino;
+    }
+};
+
+// 4K-aligned heap block, as registered and direct I/O buffers need.
+class AlignedBuffer {
+public:
+    static constexpr size_t ALIGNMENT = 4096;
+
+    explicit AlignedBuffer(size_t size)
+        : data_(static_cast<uint8_t*>(std::aligned_alloc(ALIGNMENT, roundUp(size)))), size_(size) {
+        if (!data_) {
+            throw std::bad_alloc();
+        }
+    }
+
+    uint8_t* data() const { return data_.get(); }
+    size_t size() const { return size_; }
+
+    static size_t roundUp(size_t size) { return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+
+private:
+    struct Free {
+        void operator()(uint8_t* pointer) const { std::free(pointer); }
+    };
+    std::unique_ptr<uint8_t, Free> data_;
+    size_t size_;
+};
+
+// Whole-buffer reads and writes at file offsets, up to one per buffer in
+// flight. With io_uring the file and buffers are registered once and the
+// kernel works through the queue while the caller computes; the pread
+// fallback performs each request as it is issued. Short transfers are
+// finished synchronously, so a read comes back short only at end of file.
+//
+// For a file opened with O_DIRECT (`direct`), offsets must be 4K-aligned
+// and lengths are rounded up to 4K here: reads of an unaligned tail ask
+// for the whole last page and keep what exists, writes of one are padded
+// with zeros, and the owner truncates the padding away afterwards.
+class AsyncFile {
+public:
+    struct Done {
+        unsigned buffer;
+        size_t bytes;
+    };
+
+    AsyncFile(int fd, IoMode mode, size_t buffer_size, unsigned buffers, bool direct = false)
+        : fd_(fd), direct_(direct), requests_(buffers) {
+        for (unsigned i = 0; i < buffers; i++) {
+            buffers_.emplace_back(buffer_size);
+        }
+        if (mode == IoMode::Uring) {
+            try {
+                ring_.reset(new IoUring(buffers));
+            } catch (const std::runtime_error&) {
+                return;
+            }
+            ring_->registerFile(fd_);
+            std::vector<iovec> vectors;
+            for (const AlignedBuffer& buffer : buffers_) {
+                vectors.push_back({buffer.data(), buffer.size()});
+            }
+            fixed_buffers_ = ring_->registerBuffers(vectors);
+        }
+    }
+
+    AsyncFile(const AsyncFile&) = delete;
+    AsyncFile& operator=(const AsyncFile&) = delete;
+
+    const char* backend() const { return ring_ ? "io_uring" : "pread"; }
+    uint8_t* buffer(unsigned index) const { return buffers_[index].data(); }
+    size_t bufferSize() const { return buffers_.front().size(); }
+    unsigned bufferCount() const { return static_cast<unsigned>(buffers_.size()); }
+    unsigned inFlight() const { return in_flight_; }
+    bool direct() const { return direct_; }
+
+    void read(unsigned buffer, size_t length, uint64_t offset) { issue(false, buffer, length, offset); }
+    void write(unsigned buffer, size_t length, uint64_t offset) { issue(true, buffer, length, offset); }
+
+    // The next finished request. Throws on I/O errors.
+    Done wait() {
+        if (!ring_) {
+            Done done = finished_.front();
+            finished_.pop_front();
+            in_flight_--;
+            return done;
+        }
+        IoUring::Completion completion;
+        if (!reaped_.empty()) {
+            completion = reaped_.front();
+            reaped_.pop_front();
+        } else {
+            completion = ring_->wait();
+        }
+        in_flight_--;
+        unsigned buffer = static_cast<unsigned>(completion.tag);
+        const Request& request = requests_[buffer];
+        if (completion.result < 0) {
+            fail(request.write, -completion.result);
+        }
+        size_t bytes = std::min(static_cast<size_t>(completion.result), request.length);
+        if (bytes < request.length && (request.write || bytes > 0)) {
+            bytes = transfer(request.write, buffers_[buffer].data(), request.length, request.offset, bytes);
+        }
+        return {buffer, bytes};
+    }
+
+    // Waits for everything in flight, discarding results and errors.
+    void drain() {
+        while (in_flight_ > 0) {
+            try {
+                wait();
+            } catch (const std::runtime_error&) {
+            }
+        }
+    }
+
+private:
+    struct Request {
+        bool write = false;
+        size_t length = 0;
+        uint64_t offset = 0;
+    };
+
+    int fd_;
+    bool direct_;
+    std::vector<AlignedBuffer> buffers_;
+    std::vector<Request> requests_;
+    std::unique_ptr<IoUring> ring_;
+    bool fixed_buffers_ = false;
+    std::deque<Done> finished_;  // pread fallback: completed at issue
+    std::deque<IoUring::Completion> reaped_;  // io_uring: reaped to make room in the ring
+    unsigned in_flight_ = 0;
+
+    void issue(bool write, unsigned buffer, size_t length, uint64_t offset) {
+        uint8_t* data = buffers_[buffer].data();
+        if (direct_ && write) {
+            std::memset(data + length, 0, AlignedBuffer::roundUp(length) - length);
+        }
+        requests_[buffer] = {write, length, offset};
+        in_flight_++;
+        if (!ring_) {
+            size_t bytes = 0;
+            try {
+                bytes = transfer(write, data, length, offset, 0);
+            } catch (...) {
+                in_flight_--;
+                throw;
+            }
+            finished_.push_back({buffer, bytes});
+            return;
+        }
+        int index = fixed_buffers_ ? static_cast<int>(buffer) : -1;
+        unsigned size = static_cast<unsigned>(direct_ ? AlignedBuffer::roundUp(length) : length);
+        while (!(write ? ring_->write(fd_, data, size, offset, index, buffer)
+                       : ring_->read(fd_, data, size, offset, index, buffer))) {
+            // The submission ring is full, which leaves requests the kernel
+            // has not taken yet. Waiting submits them; the completion is
+            // kept for wait() and the request tried again.
+            if (in_flight_ - 1 == reaped_.size()) {
+                in_flight_--;
+                fail(write, EBUSY);
+            }
+            reaped_.push_back(ring_->wait());
+        }
+        ring_->submit();
+    }
+
+    // Blocking pread/pwrite loop moving data[done, length) to or from
+    // `offset`; reads stop early at end of file. Direct I/O resumes from
+    // the last whole page and moves whole pages.
+    size_t transfer(bool write, uint8_t* data, size_t length, uint64_t offset, size_t done) {
+        size_t end = direct_ ? AlignedBuffer::roundUp(length) : length;
+        while (done < length) {
+            if (direct_) {
+                done = done / AlignedBuffer::ALIGNMENT * AlignedBuffer::ALIGNMENT;
+            }
+            ssize_t moved = write ? pwrite(fd_, data + done, end - done, static_cast<off_t>(offset + done))
+                                  : pread(fd_, data + done, end - done, static_cast<off_t>(offset + done));
+            if (moved < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fail(write, errno);
+            }
+            if (moved == 0) {
+                if (write) {
+                    fail(write, EIO);
+                }
+                break;
+            }
+            done += static_cast<size_t>(moved);
+        }
+        return std::min(done, length);
+    }
+
+    [[noreturn]] static void fail(bool write, int error) {
+        throw std::runtime_error(std::string(write ? "Write failed: " : "Read failed: ") + std::strerror(error));
+    }
+};
+
+// Sequential reads with read-ahead: every buffer is kept busy reading the
+// next stretch of the file while the caller consumes the current one.
+// Seeking within the current buffer is free; anywhere else restarts the
+// read-ahead there. Nothing is read until the first byte is asked for, so
+// probing the size with seeks costs no I/O.
+class FileReadBuf : public std::streambuf {
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+    static constexpr unsigned QUEUE_DEPTH = 4;
+
+    FileReadBuf(int fd, IoMode mode, uint64_t size, bool direct = false)
+        : file_(fd, mode, BUFFER_SIZE, QUEUE_DEPTH, direct), size_(size), state_(QUEUE_DEPTH, IDLE),
+          offsets_(QUEUE_DEPTH, 0) {
+        start(0);
+    }
+
+    ~FileReadBuf() override { file_.drain(); }
+
+    const char* backend() const { return file_.backend(); }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+        if (current_ >= 0) {
+            state_[current_] = IDLE;
+            submit(static_cast<unsigned>(current_));
+            current_ = -1;
+            setg(nullptr, nullptr, nullptr);
+        }
+        if (!primed_) {
+            primed_ = true;
+            for (unsigned buffer = 0; buffer < QUEUE_DEPTH; buffer++) {
+                submit(buffer);
+            }
+        }
+        unsigned buffer = head_;
+        if (state_[buffer] == IDLE) {
+            return traits_type::eof();
+        }
+        while (state_[buffer] == IN_FLIGHT) {
+            AsyncFile::Done done = file_.wait();
+            state_[done.buffer] = static_cast<int64_t>(done.bytes);
+        }
+        head_ = (head_ + 1) % QUEUE_DEPTH;
+        current_ = static_cast<int>(buffer);
+        position_ = offsets_[buffer];
+        char* data = reinterpret_cast<char*>(file_.buffer(buffer));
+        size_t skip = std::min<size_t>(skip_, static_cast<size_t>(state_[buffer]));
+        skip_ = 0;
+        setg(data, data + skip, data + state_[buffer]);
+        return gptr() < egptr() ? traits_type::to_int_type(*gptr()) : traits_type::eof();
+    }
+
+    pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which) override {
+        off_type base = direction == std::ios_base::beg   ? 0
+                        : direction == std::ios_base::cur ? static_cast<off_type>(tell())
+                                                          : static_cast<off_type>(size_);
+        return seekpos(pos_type(base + offset), which);
+    }
+
+    pos_type seekpos(pos_type target, std::ios_base::openmode which) override {
+        off_type position = target;
+        if (!(which & std::ios_base::in) || position < 0 || static_cast<uint64_t>(position) > size_) {
+            return pos_type(off_type(-1));
+        }
+        uint64_t wanted = static_cast<uint64_t>(position);
+        if (current_ >= 0 && wanted >= position_ && wanted <= position_ + static_cast<uint64_t>(egptr() - eback())) {
+            setg(eback(), eback() + (wanted - position_), egptr());
+            return target;
+        }
+        file_.drain();
+        start(wanted);
+        return target;
+    }
+
+private:
+    static constexpr int64_t IDLE = -2;
+    static constexpr int64_t IN_FLIGHT = -1;
+
+    AsyncFile file_;
+    uint64_t size_;
+    std::vector<int64_t> state_;  // bytes read, or IDLE / IN_FLIGHT
+    std::vector<uint64_t> offsets_;
+    uint64_t next_ = 0;      // file offset of the next read to issue
+    uint64_t position_ = 0;  // file offset of eback()
+    size_t skip_ = 0;        // bytes to skip in the next buffer after a seek
+    unsigned head_ = 0;      // next buffer to consume; buffers fill in turn
+    int current_ = -1;       // buffer behind the get area
+    bool primed_ = false;    // read-ahead issued since the last start()
+
+    uint64_t tell() const { return position_ + static_cast<uint64_t>(gptr() - eback()); }
+
+    void start(uint64_t position) {
+        std::fill(state_.begin(), state_.end(), IDLE);
+        next_ = position / AlignedBuffer::ALIGNMENT * AlignedBuffer::ALIGNMENT;
+        skip_ = static_cast<size_t>(position - next_);
+        position_ = position;
+        head_ = 0;
+        current_ = -1;
+        primed_ = false;
+        setg(nullptr, nullptr, nullptr);
+    }
+
+    void submit(unsigned buffer) {
+        if (next_ >= size_) {
+            return;
+        }
+        size_t length = static_cast<size_t>(std::min<uint64_t>(BUFFER_SIZE, size_ - next_));
+        offsets_[buffer] = next_;
+        state_[buffer] = IN_FLIGHT;
+        file_.read(buffer, length, next_);
+        next_ += length;
+    }
+};
+
+// Sequential writes with write-behind: a full buffer is queued and the
+// caller carries on filling the next while the kernel writes it out.
+class FileWriteBuf : public std::streambuf {
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+    static constexpr unsigned QUEUE_DEPTH = 4;
+
+    FileWriteBuf(int fd, IoMode mode, bool direct = false)
+        : fd_(fd), file_(fd, mode, BUFFER_SIZE, QUEUE_DEPTH, direct), busy_(QUEUE_DEPTH, false) {}
+
+    ~FileWriteBuf() override { file_.drain(); }
+
+    const char* backend() const { return file_.backend(); }
+
+    // Writes out everything buffered and waits for it. Only the last
+    // buffer can be partial, so direct writes stay aligned until then; its
+    // padding is cut off here. Throws on failure.
+    void finish() {
+        queueCurrent();
+        while (file_.inFlight() > 0) {
+            busy_[file_.wait().buffer] = false;
+        }
+        if (file_.direct() && offset_ % AlignedBuffer::ALIGNMENT != 0 &&
+            ftruncate(fd_, static_cast<off_t>(offset_)) != 0) {
+            throw std::runtime_error(std::string("Write failed: ") + std::strerror(errno));
+        }
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        queueCurrent();
+        unsigned buffer = 0;
+        while (busy_[buffer]) {
+            if (++buffer == QUEUE_DEPTH) {
+                buffer = file_.wait().buffer;
+                busy_[buffer] = false;
+            }
+        }
+        current_ = static_cast<int>(buffer);
+        char* data = reinterpret_cast<char*>(file_.buffer(buffer));
+        setp(data, data + BUFFER_SIZE);
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+private:
+    int fd_;
+    AsyncFile file_;
+    std::vector<bool> busy_;
+    uint64_t offset_ = 0;
+    int current_ = -1;
+
+    void queueCurrent() {
+        if (current_ < 0) {
+            return;
+        }
+        size_t length = static_cast<size_t>(pptr() - pbase());
+        unsigned buffer = static_cast<unsigned>(current_);
+        current_ = -1;
+        setp(nullptr, nullptr);
+        if (length > 0) {
+            busy_[buffer] = true;
+            file_.write(buffer, length, offset_);
+            offset_ += length;
+        }
+    }
+};
+
+// Writes at explicit offsets with pwrite(2). Each call names its own
+// offset, so any number of threads can write disjoint ranges at once with
+// no ordering between them.
+class PositionalFile {
+public:
+    explicit PositionalFile(int fd) : fd_(fd) {}
+
+    // Allocates `length` bytes at `offset` ahead of the write that fills
+    // them, so blocks written out of order do not leave the file
+    // fragmented. The file's size is left alone (FALLOC_FL_KEEP_SIZE), so
+    // it only ever covers bytes actually written. Where fallocate(2) is
+    // unsupported, the write allocates instead; any other failure, such
+    // as a full disk, throws.
+    void reserve(uint64_t offset, uint64_t length) {
+#ifdef __linux__
+        if (length == 0 || offset > static_cast<uint64_t>(INT64_MAX) - length) {
+            return;
+        }
+        int result;
+        do {
+            result = fallocate(fd_, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset), static_cast<off_t>(length));
+        } while (result != 0 && errno == EINTR);
+        if (result != 0 && errno != EOPNOTSUPP && errno != ENOSYS) {
+            throw std::runtime_error(std::string("Cannot reserve space: ") + std::strerror(errno));
+        }
+#else
+        (void)offset;
+        (void)length;
+#endif
+    }
+
+    void writeAt(uint64_t offset, const uint8_t* data, size_t length) {
+        size_t done = 0;
+        while (done < length) {
+            ssize_t moved = pwrite(fd_, data + done, length - done, static_cast<off_t>(offset + done));
+            if (moved < 0 && errno == EINTR) {
+                continue;
+            }
+            if (moved <= 0) {
+                throw std::runtime_error(std::string("Write failed: ") +
+                                         (moved < 0 ? std::strerror(errno) : "no progress"));
+            }
+            done += static_cast<size_t>(moved);
+        }
+    }
+
+    // Cuts the file to what was actually written.
+    void truncate(uint64_t size) {
+        if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+            throw std::runtime_error(std::string("Write failed: ") + std::strerror(errno));
+        }
+    }
+
+private:
+    int fd_;
+};
+
+// A file opened for the container: the read-ahead/write-behind buffers
+// above for regular files, std::ifstream/std::ofstream for IoMode::Stream
+// and for pipes and devices. I/O errors surface as exceptions.
+//
+// `direct` opens with O_DIRECT so large jobs bypass the page cache instead
+// of evicting everyone else's pages; where the filesystem refuses O_DIRECT
+// (tmpfs, some network filesystems) the file is opened normally.
+//
+// A regular output file opened without O_DIRECT can also be written at
+// explicit offsets through positional(), by several threads at once,
+// instead of through stream(); a writer uses one or the other.
+class InputFile {
+public:
+    InputFile(const std::string& path, IoMode mode, bool direct = false) {
+        if (direct && mode == IoMode::Stream) {
+            throw std::runtime_error("Direct I/O needs --io uring or pread");
+        }
+        if (mode != IoMode::Stream) {
+            fd_ = FileIo::openFile(path, O_RDONLY | O_CLOEXEC, direct);
+            struct stat info;
+            if (fd_ >= 0 && fstat(fd_, &info) == 0 && S_ISREG(info.st_mode)) {
+                uint64_t size = static_cast<uint64_t>(info.st_size);
+                buffer_.reset(new FileReadBuf(fd_, mode, size, direct && FileIo::isDirect(fd_)));
+                stream_.reset(new std::istream(buffer_.get()));
+                stream_->exceptions(std::ios::badbit);
+                return;
+            }
+            closeFd();
+        }
+        stream_.reset(new std::ifstream(path, std::ios::binary));
+        if (!*stream_) {
+            throw std::runtime_error("Cannot open file: " + path);
+        }
+    }
+
+    ~InputFile() {
+        stream_.reset();
+        buffer_.reset();
+        closeFd();
+    }
+
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+
+    std::istream& stream() { return *stream_; }
+    const char* backend() const { return buffer_ ? buffer_->backend() : "iostream"; }
+
+private:
+    int fd_ = -1;
+    std::unique_ptr<FileReadBuf> buffer_;
+    std::unique_ptr<std::istream> stream_;
+
+    void closeFd() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+};
+
+class OutputFile {
+public:
+    OutputFile(const std::string& path, IoMode mode, bool direct = false) : path_(path) {
+        if (direct && mode == IoMode::Stream) {
+            throw std::runtime_error("Direct I/O needs --io uring or pread");
+        }
+        if (mode != IoMode::Stream) {
+            fd_ = FileIo::openFile(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, direct);
+            struct stat info;
+            if (fd_ >= 0 && fstat(fd_, &info) == 0 && S_ISREG(info.st_mode)) {
+                bool is_direct = direct && FileIo::isDirect(fd_);
+                buffer_.reset(new FileWriteBuf(fd_, mode, is_direct));
+                if (!is_direct) {
+                    positional_.reset(new PositionalFile(fd_));
+                }
+                stream_.reset(new std::ostream(buffer_.get()));
+                stream_->exceptions(std::ios::badbit);
+                return;
+            }
+            closeFd();
+        }
+        stream_.reset(new std::ofstream(path, std::ios::binary));
+        if (!*stream_) {
+            throw std::runtime_error("Cannot write to file: " + path);
+        }
+    }
+
+    ~OutputFile() {
+        stream_.reset();
+        buffer_.reset();
+        closeFd();
+    }
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    std::ostream& stream() { return *stream_; }
+    const char* backend() const { return buffer_ ? buffer_->backend() : "iostream"; }
+
+    // Null for pipes, devices, IoMode::Stream and O_DIRECT, whose writes
+    // must stay sequential or aligned.
+    PositionalFile* positional() { return positional_.get(); }
+
+    // Flushes and closes; only after this has returned is the file complete.
+    void close() {
+        if (buffer_) {
+            buffer_->finish();
+        } else {
+            stream_->flush();
+            if (!*stream_) {
+                throw std::runtime_error("Write failed: " + path_);
+            }
+        }
+        if (fd_ >= 0 && ::close(fd_) != 0) {
+            fd_ = -1;
+            throw std::runtime_error("Write failed: " + path_);
+        }
+        fd_ = -1;
+    }
+
+private:
+    std::string path_;
+    int fd_ = -1;
+    std::unique_ptr<FileWriteBuf> buffer_;
+    std::unique_ptr<PositionalFile> positional_;
+    std::unique_ptr<std::ostream> stream_;
+
+    void closeFd() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+};
+
+#endif
@@ -1,19 +1,31 @@
 #ifndef HUFFMAN_HPP
 #define HUFFMAN_HPP
 
-#include <bitset>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <queue>
-#include <unordered_map>
+#include <stdexcept>
 #include <vector>
 
+#include "arena.hpp"
+#include "bytes.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+
+// Trees built inside an ArenaScope take their nodes from the thread's arena
+// and must not outlive the scope.
 struct HuffmanNode {
     uint8_t data;
-    int frequency;
+    uint64_t frequency;
     std::shared_ptr<HuffmanNode> left;
     std::shared_ptr<HuffmanNode> right;
 
-    HuffmanNode(uint8_t d, int freq) : data(d), frequency(freq), left(nullptr), right(nullptr) {}
-    HuffmanNode(int freq) : data(0), frequency(freq), left(nullptr), right(nullptr) {}
+    HuffmanNode(uint8_t d, uint64_t freq) : data(d), frequency(freq), left(nullptr), right(nullptr) {}
+    HuffmanNode(uint64_t freq) : data(0), frequency(freq), left(nullptr), right(nullptr) {}
 };
 
 struct Compare {
@@ -23,149 +35,575 @@ struct Compare {
 };
 
 class Huffman {
-private:
-    static void generateCodes(std::shared_ptr<HuffmanNode> root, std::string code,
-                             std::unordered_map<uint8_t, std::string>& codes) {
-        if (!root) {
-            return;
-        }
+public:
+    using Histogram = std::array<uint64_t, 256>;
 
-        if (!root->left && !root->right) {
-            codes[root->data] = code.empty() ? "0" : code;
-            return;
-        }
+    // Canonical bit patterns of a tree: left edges are 0, right edges are 1,
+    // most significant bit first.
+    struct CodeTable {
+        std::array<uint64_t, 256> code{};
+        std::array<uint8_t, 256> length{};
+    };
 
-        generateCodes(root->left, code + "0", codes);
-        generateCodes(root->right, code + "1", codes);
+    // With a nonzero `max_length` (at least 8), frequencies are flattened
+    // until no code is longer than that.
+    static std::shared_ptr<HuffmanNode> buildTree(const Histogram& frequency, int max_length = 0) {
+        auto root = buildUnlimitedTree(frequency);
+        if (max_length <= 0 || depth(root.get()) <= max_length) {
+            return root;
+        }
+        if (max_length < 8) {
+            throw std::runtime_error("Huffman code length limit must be at least 8");
+        }
+        Histogram flattened = frequency;
+        do {
+            for (uint64_t& count : flattened) {
+                if (count > 0) {
+                    count = (count + 1) / 2;
+                }
+            }
+            root = buildUnlimitedTree(flattened);
+        } while (depth(root.get()) > max_length);
+        return root;
     }
 
-public:
-    static std::pair<std::vector<uint8_t>, std::shared_ptr<HuffmanNode>> compress(const std::vector<uint8_t>& data) {
-        if (data.empty()) return {std::vector<uint8_t>(), nullptr};
-
-        std::unordered_map<uint8_t, int> frequency;
-        for (uint8_t byte : data) {
-            frequency[byte]++;
+    static int depth(const HuffmanNode* node) {
+        if (!node || (!node->left && !node->right)) {
+            return 0;
         }
+        return 1 + std::max(depth(node->left.get()), depth(node->right.get()));
+    }
 
-        std::priority_queue<std::shared_ptr<HuffmanNode>, std::vector<std::shared_ptr<HuffmanNode>>, Compare> pq;
+    static std::shared_ptr<HuffmanNode> buildUnlimitedTree(const Histogram& frequency) {
+        ArenaAllocator<HuffmanNode> nodes;
+        std::priority_queue<std::shared_ptr<HuffmanNode>, ArenaVector<std::shared_ptr<HuffmanNode>>, Compare> pq;
 
-        for (auto& pair : frequency) {
-            pq.push(std::make_shared<HuffmanNode>(pair.first, pair.second));
+        for (int symbol = 0; symbol < 256; symbol++) {
+            if (frequency[symbol] > 0) {
+                pq.push(std::allocate_shared<HuffmanNode>(nodes, static_cast<uint8_t>(symbol), frequency[symbol]));
+            }
+        }
+        if (pq.empty()) {
+            return nullptr;
         }
 
         while (pq.size() > 1) {
             auto left = pq.top(); pq.pop();
             auto right = pq.top(); pq.pop();
 
-            auto merged = std::make_shared<HuffmanNode>(left->frequency + right->frequency);
+            auto merged = std::allocate_shared<HuffmanNode>(nodes, left->frequency + right->frequency);
             merged->left = left;
             merged->right = right;
 
             pq.push(merged);
         }
 
-        auto root = pq.top();
+        return pq.top();
+    }
 
-        std::unordered_map<uint8_t, std::string> codes;
-        generateCodes(root, "", codes);
+    static CodeTable buildCodeTable(const std::shared_ptr<HuffmanNode>& root) {
+        CodeTable table;
+        if (!root) {
+            return table;
+        }
+        if (!root->left && !root->right) {
+            table.length[root->data] = 1;
+            return table;
+        }
+        std::function<void(const HuffmanNode*, uint64_t, int)> walk =
+            [&](const HuffmanNode* node, uint64_t code, int length) {
+                if (!node) return;
+                if (!node->left && !node->right) {
+                    if (length > 64) {
+                        throw std::runtime_error("Huffman code longer than 64 bits");
+                    }
+                    table.code[node->data] = code;
+                    table.length[node->data] = static_cast<uint8_t>(length);
+                    return;
+                }
+                walk(node->left.get(), code << 1, length + 1);
+                walk(node->right.get(), (code << 1) | 1, length + 1);
+            };
+        walk(root.get(), 0, 0);
+        return table;
+    }
 
-        std::string encoded = "";
-        for (uint8_t byte : data) {
-            encoded += codes[byte];
+    // Writes each byte's code into `Sink`, most significant bit first.
+    template <typename Sink>
+    class BitWriter {
+    public:
+        template <typename... Args>
+        explicit BitWriter(const CodeTable& table, Args&&... args)
+            : table_(table), sink_(std::forward<Args>(args)...) {}
+
+        void put(uint8_t byte) {
+            int length = table_.length[byte];
+            uint64_t code = table_.code[byte];
+            if (length > 32) {
+                append(code >> 32, length - 32);
+                length = 32;
+            }
+            append(code & 0xFFFFFFFFull, length);
         }
 
-        std::vector<uint8_t> compressed;
-        for (size_t i = 0; i < encoded.length(); i += 8) {
-            std::string byte_str = encoded.substr(i, 8);
-            while (byte_str.length() < 8) byte_str += "0";
-            compressed.push_back(static_cast<uint8_t>(std::stoi(byte_str, 0, 2)));
+        // Starts the output `count` (< 8) zero bits into its first byte, for a
+        // stream that continues one ending mid-byte.
+        void skipBits(int count) { append(0, count); }
+
+        void finish() {
+            if (pending_ > 0) {
+                sink_.put(static_cast<uint8_t>(accumulator_ << (8 - pending_)));
+                pending_ = 0;
+            }
+            sink_.finish();
+        }
+
+    private:
+        const CodeTable& table_;
+        Sink sink_;
+        uint64_t accumulator_ = 0;
+        int pending_ = 0;
+
+        void append(uint64_t bits, int length) {
+            accumulator_ = (accumulator_ << length) | bits;
+            pending_ += length;
+            while (pending_ >= 8) {
+                pending_ -= 8;
+                sink_.put(static_cast<uint8_t>(accumulator_ >> pending_));
+            }
         }
+    };
 
+    // Walks `bit_count` bits of `bits` through the tree, pushing each decoded
+    // byte into `sink`.
+    template <typename Sink>
+    static void decodeTo(const uint8_t* bits, uint64_t bit_count, const HuffmanNode* root, Sink& sink) {
+        if (!root) {
+            return;
+        }
+        if (!root->left && !root->right) {
+            for (uint64_t i = 0; i < bit_count; i++) {
+                sink.put(root->data);
+            }
+            return;
+        }
+        const HuffmanNode* current = root;
+        for (uint64_t i = 0; i < bit_count; i++) {
+            bool bit = (bits[i >> 3] >> (7 - (i & 7))) & 1;
+            current = bit ? current->right.get() : current->left.get();
+            if (!current) {
+                throw std::runtime_error("Corrupted Huffman code");
+            }
+            if (!current->left && !current->right) {
+                sink.put(current->data);
+                current = root;
+            }
+        }
+    }
+
+    // Encoding can split the input over `threads` threads (0 = one per
+    // core): each counts its slice, the counts merge into one code table,
+    // and each writes its codes straight into its own bit range of the
+    // output, found by a prefix sum over the slices' code lengths. The
+    // bytes are identical to a single-threaded encode.
+    static constexpr size_t MIN_PARALLEL_CHUNK = 64 * 1024;
+
+    // Self-contained framing: u64 code bits | u64 tree size | tree | code bytes.
+    //
+    // With a nonzero `checkpoint_interval` the encoder also records where
+    // every interval-th symbol starts, so decoding can split the stream
+    // over threads, each filling its own slice of the output. The top bit
+    // of the tree size is then set and the tree is followed by
+    //   u64 symbol count | u32 interval | u32 checkpoint count | u64 bit offset*
+    // where checkpoint k (from 1) is the first bit of symbol k * interval.
+    static constexpr uint32_t DEFAULT_CHECKPOINT_INTERVAL = 64 * 1024;
+
+    static std::vector<uint8_t> compressFramed(const std::vector<uint8_t>& data, int max_length = 0,
+                                               unsigned threads = 1, uint32_t checkpoint_interval = 0);
+    static std::vector<uint8_t> decompressFramed(const std::vector<uint8_t>& data, unsigned threads = 1);
+
+    // Overwrite `out`, reusing its capacity. Tree and scratch live in the
+    // thread's arena for the duration of the call.
+    static void compressFramed(const std::vector<uint8_t>& data, std::vector<uint8_t>& out, int max_length = 0,
+                               unsigned threads = 1, uint32_t checkpoint_interval = 0);
+    static void decompressFramed(const std::vector<uint8_t>& data, std::vector<uint8_t>& out, unsigned threads = 1);
+
+    static std::pair<std::vector<uint8_t>, std::shared_ptr<HuffmanNode>> compress(const std::vector<uint8_t>& data,
+                                                                                  int max_length = 0,
+                                                                                  unsigned threads = 1) {
+        if (data.empty()) return {std::vector<uint8_t>(), nullptr};
+
+        ArenaVector<Histogram> counts;
+        Histogram frequency;
+        std::shared_ptr<HuffmanNode> root = countAndBuildTree(data, max_length, threads, counts, frequency);
+        CodeTable table = buildCodeTable(root);
+        std::vector<uint8_t> compressed;
+        writeCodes(data, table, counts, threads, compressed);
         return {compressed, root};
     }
 
     static std::vector<uint8_t> decompress(const std::vector<uint8_t>& compressed,
                                          std::shared_ptr<HuffmanNode> root, size_t original_bits) {
-        if (!root || compressed.empty()) return std::vector<uint8_t>();
-
         std::vector<uint8_t> decompressed;
-        std::string bit_string = "";
+        decodeBits(compressed.data(), compressed.size(), root.get(), original_bits, decompressed);
+        return decompressed;
+    }
+
+private:
+    struct AppendSink {
+        std::vector<uint8_t>& out;
+        void put(uint8_t byte) { out.push_back(byte); }
+        void finish() {}
+    };
+
+    // A chunk's partial first and last bytes, which it shares with its
+    // neighbours.
+    struct EdgeBytes {
+        size_t index[2];
+        uint8_t value[2];
+        int count = 0;
+    };
 
-        for (uint8_t byte : compressed) {
-            std::bitset<8> bits(byte);
-            bit_string += bits.to_string();
+    // Stores a chunk's bytes straight into its slice of the output, except
+    // the shared ones, which are OR-ed in once every chunk is done.
+    struct RangeSink {
+        uint8_t* out;
+        size_t next;
+        size_t first_shared;
+        size_t last_shared;
+        EdgeBytes& edges;
+
+        void put(uint8_t byte) {
+            size_t index = next++;
+            if (index == first_shared || index == last_shared) {
+                edges.index[edges.count] = index;
+                edges.value[edges.count++] = byte;
+            } else {
+                out[index] = byte;
+            }
         }
+        void finish() {}
+    };
+
+    static size_t chunkCount(size_t size, unsigned threads) {
+        return std::max<size_t>(1, std::min<size_t>(Parallel::resolve(threads), size / MIN_PARALLEL_CHUNK));
+    }
 
-        if (original_bits > 0 && original_bits < bit_string.length()) {
-            bit_string = bit_string.substr(0, original_bits);
+    // Counts each chunk of `data` into `counts`, merges them into
+    // `frequency` and builds the tree.
+    static std::shared_ptr<HuffmanNode> countAndBuildTree(const std::vector<uint8_t>& data, int max_length,
+                                                          unsigned threads, ArenaVector<Histogram>& counts,
+                                                          Histogram& frequency) {
+        size_t chunks = chunkCount(data.size(), threads);
+        counts.assign(chunks, Histogram{});
+        frequency.fill(0);
+        {
+            PhaseTimer timer("huffman.histogram", data.size());
+            Parallel::forEach(chunks, threads, [&](size_t chunk) {
+                Histogram& local = counts[chunk];
+                size_t end = Parallel::split(data.size(), chunks, chunk + 1);
+                for (size_t i = Parallel::split(data.size(), chunks, chunk); i < end; i++) {
+                    local[data[i]]++;
+                }
+            });
+            for (const Histogram& local : counts) {
+                for (int symbol = 0; symbol < 256; symbol++) {
+                    frequency[symbol] += local[symbol];
+                }
+            }
         }
+        PhaseTimer timer("huffman.tree");
+        return buildTree(frequency, max_length);
+    }
 
-        auto current = root;
-        for (char bit : bit_string) {
-            if (bit == '0') {
-                current = current->left;
-            } else {
-                current = current->right;
+    // Appends the codes for `data`, zero-padded to a whole byte, one chunk
+    // per entry of `counts`.
+    static void writeCodes(const std::vector<uint8_t>& data, const CodeTable& table,
+                           const ArenaVector<Histogram>& counts, unsigned threads, std::vector<uint8_t>& out) {
+        PhaseTimer timer("huffman.encode", data.size());
+        size_t chunks = counts.size();
+        if (chunks <= 1) {
+            BitWriter<AppendSink> writer(table, AppendSink{out});
+            for (uint8_t byte : data) {
+                writer.put(byte);
             }
+            writer.finish();
+            return;
+        }
 
-            if (!current->left && !current->right) {
-                decompressed.push_back(current->data);
-                current = root;
+        // Exclusive prefix sum of chunk code lengths gives each chunk's
+        // first bit.
+        ArenaVector<uint64_t> offsets(chunks + 1);
+        for (size_t chunk = 0; chunk < chunks; chunk++) {
+            uint64_t bits = 0;
+            for (int symbol = 0; symbol < 256; symbol++) {
+                bits += counts[chunk][symbol] * table.length[symbol];
             }
+            offsets[chunk + 1] = offsets[chunk] + bits;
         }
 
-        return decompressed;
+        size_t base = out.size();
+        out.resize(base + (offsets[chunks] + 7) / 8, 0);
+        ArenaVector<EdgeBytes> edges(chunks);
+        Parallel::forEach(chunks, threads, [&](size_t chunk) {
+            uint64_t begin = offsets[chunk];
+            uint64_t end = offsets[chunk + 1];
+            if (begin == end) {
+                return;
+            }
+            size_t first = base + begin / 8;
+            size_t last = base + (end - 1) / 8;
+            RangeSink sink{out.data(), first, begin % 8 ? first : SIZE_MAX, end % 8 ? last : SIZE_MAX,
+                           edges[chunk]};
+            BitWriter<RangeSink> writer(table, sink);
+            writer.skipBits(static_cast<int>(begin % 8));
+            size_t stop = Parallel::split(data.size(), chunks, chunk + 1);
+            for (size_t i = Parallel::split(data.size(), chunks, chunk); i < stop; i++) {
+                writer.put(data[i]);
+            }
+            writer.finish();
+        });
+        for (const EdgeBytes& edge : edges) {
+            for (int i = 0; i < edge.count; i++) {
+                out[edge.index[i]] |= edge.value[i];
+            }
+        }
     }
-};
 
-std::vector<uint8_t> serializeTree(std::shared_ptr<HuffmanNode> node) {
-    std::vector<uint8_t> result;
-    if (!node) {
-        result.push_back(0); // null marker
-        return result;
+    // Decodes the first `original_bits` bits (all of them if 0) into `out`.
+    static void decodeBits(const uint8_t* bits, size_t size, const HuffmanNode* root, uint64_t original_bits,
+                           std::vector<uint8_t>& out) {
+        out.clear();
+        if (!root || size == 0) {
+            return;
+        }
+        PhaseTimer timer("huffman.decode", size);
+        uint64_t bit_count = static_cast<uint64_t>(size) * 8;
+        if (original_bits > 0 && original_bits < bit_count) {
+            bit_count = original_bits;
+        }
+        AppendSink sink{out};
+        decodeTo(bits, bit_count, root, sink);
+    }
+
+    static constexpr uint64_t CHECKPOINTED = 1ull << 63;
+
+    // Bit offsets of symbols interval, 2 * interval, ... under `table`.
+    static void findCheckpoints(const std::vector<uint8_t>& data, const CodeTable& table, uint32_t interval,
+                                unsigned threads, ArenaVector<uint64_t>& checkpoints) {
+        size_t segments = (data.size() + interval - 1) / interval;
+        ArenaVector<uint64_t> bits(segments);
+        Parallel::forEach(segments, threads, [&](size_t segment) {
+            size_t end = std::min(data.size(), (segment + 1) * interval);
+            uint64_t total = 0;
+            for (size_t i = segment * interval; i < end; i++) {
+                total += table.length[data[i]];
+            }
+            bits[segment] = total;
+        });
+        checkpoints.assign(segments > 0 ? segments - 1 : 0, 0);
+        uint64_t offset = 0;
+        for (size_t k = 0; k < checkpoints.size(); k++) {
+            offset += bits[k];
+            checkpoints[k] = offset;
+        }
+    }
+
+    // Decodes exactly `count` symbols from bits [begin, end) into `out`;
+    // the codes must fill the range exactly.
+    static void decodeRange(const uint8_t* bits, uint64_t begin, uint64_t end, const HuffmanNode* root,
+                            uint8_t* out, size_t count) {
+        if (!root) {
+            throw std::runtime_error("Corrupted Huffman checkpoint");
+        }
+        if (!root->left && !root->right) {
+            if (end - begin != count) {
+                throw std::runtime_error("Corrupted Huffman checkpoint");
+            }
+            std::memset(out, root->data, count);
+            return;
+        }
+        uint64_t position = begin;
+        for (size_t i = 0; i < count; i++) {
+            const HuffmanNode* current = root;
+            while (current->left || current->right) {
+                if (position >= end) {
+                    throw std::runtime_error("Corrupted Huffman checkpoint");
+                }
+                bool bit = (bits[position >> 3] >> (7 - (position & 7))) & 1;
+                position++;
+                current = bit ? current->right.get() : current->left.get();
+                if (!current) {
+                    throw std::runtime_error("Corrupted Huffman code");
+                }
+            }
+            out[i] = current->data;
+        }
+        if (position != end) {
+            throw std::runtime_error("Corrupted Huffman checkpoint");
+        }
     }
+};
 
-    if (!node->left && !node->right) {
-        result.push_back(1); // leaf marker
-        result.push_back(node->data);
+// Pre-order: 0 = null, 1 = leaf followed by its byte, 2 = internal node.
+inline void appendTree(const HuffmanNode* node, std::vector<uint8_t>& out) {
+    if (!node) {
+        out.push_back(0);
+    } else if (!node->left && !node->right) {
+        out.push_back(1);
+        out.push_back(node->data);
     } else {
-        result.push_back(2); // internal marker
-        auto left_data = serializeTree(node->left);
-        auto right_data = serializeTree(node->right);
-        result.insert(result.end(), left_data.begin(), left_data.end());
-        result.insert(result.end(), right_data.begin(), right_data.end());
+        out.push_back(2);
+        appendTree(node->left.get(), out);
+        appendTree(node->right.get(), out);
     }
-    return result;
 }
 
-std::pair<std::shared_ptr<HuffmanNode>, size_t> deserializeTree(const std::vector<uint8_t>& data, size_t offset) {
-    if (offset >= data.size()) {
-        return {nullptr, offset};
+// Reads a tree from data[offset, size), advancing `offset` past it.
+inline std::shared_ptr<HuffmanNode> readTree(const uint8_t* data, size_t size, size_t& offset) {
+    if (offset >= size) {
+        return nullptr;
     }
 
     uint8_t marker = data[offset++];
     if (marker == 0) {
-        return {nullptr, offset};
+        return nullptr;
     } else if (marker == 1) {
-        // Leaf node
-        if (offset >= data.size()) {
+        if (offset >= size) {
             throw std::runtime_error("Corrupted tree data");
         }
-        uint8_t nodeData = data[offset++];
-        auto node = std::make_shared<HuffmanNode>(nodeData, 0);
-        return {node, offset};
+        return std::allocate_shared<HuffmanNode>(ArenaAllocator<HuffmanNode>(), data[offset++], 0);
     } else if (marker == 2) {
-        // Internal node
-        auto node = std::make_shared<HuffmanNode>(0);
-        auto [left, newOffset] = deserializeTree(data, offset);
-        auto [right, finalOffset] = deserializeTree(data, newOffset);
-        node->left = left;
-        node->right = right;
-        return {node, finalOffset};
+        auto node = std::allocate_shared<HuffmanNode>(ArenaAllocator<HuffmanNode>(), 0);
+        node->left = readTree(data, size, offset);
+        node->right = readTree(data, size, offset);
+        return node;
     } else {
         throw std::runtime_error("Invalid tree marker");
     }
 }
 
-#endif
\ No newline at end of file
+std::vector<uint8_t> serializeTree(std::shared_ptr<HuffmanNode> node) {
+    std::vector<uint8_t> result;
+    appendTree(node.get(), result);
+    return result;
+}
+
+std::pair<std::shared_ptr<HuffmanNode>, size_t> deserializeTree(const std::vector<uint8_t>& data, size_t offset) {
+    auto node = readTree(data.data(), data.size(), offset);
+    return {node, offset};
+}
+
+inline std::vector<uint8_t> Huffman::compressFramed(const std::vector<uint8_t>& data, int max_length,
+                                                    unsigned threads, uint32_t checkpoint_interval) {
+    std::vector<uint8_t> result;
+    compressFramed(data, result, max_length, threads, checkpoint_interval);
+    return result;
+}
+
+inline std::vector<uint8_t> Huffman::decompressFramed(const std::vector<uint8_t>& data, unsigned threads) {
+    std::vector<uint8_t> result;
+    decompressFramed(data, result, threads);
+    return result;
+}
+
+inline void Huffman::compressFramed(const std::vector<uint8_t>& data, std::vector<uint8_t>& out, int max_length,
+                                    unsigned threads, uint32_t checkpoint_interval) {
+    ArenaScope scope;
+    ArenaVector<Histogram> counts;
+    Histogram frequency;
+    auto tree = countAndBuildTree(data, max_length, threads, counts, frequency);
+    CodeTable table = buildCodeTable(tree);
+    uint64_t code_bits = 0;
+    for (int symbol = 0; symbol < 256; symbol++) {
+        code_bits += frequency[symbol] * table.length[symbol];
+    }
+
+    out.clear();
+    writeUint64(out, code_bits);
+    writeUint64(out, 0);
+    appendTree(tree.get(), out);
+    uint64_t tree_size = out.size() - 16;
+    if (checkpoint_interval > 0) {
+        tree_size |= CHECKPOINTED;
+    }
+    for (int i = 0; i < 8; i++) {
+        out[8 + i] = static_cast<uint8_t>(tree_size >> (8 * i));
+    }
+    if (checkpoint_interval > 0) {
+        PhaseTimer timer("huffman.checkpoints", data.size());
+        ArenaVector<uint64_t> checkpoints;
+        findCheckpoints(data, table, checkpoint_interval, threads, checkpoints);
+        writeUint64(out, data.size());
+        writeUint32(out, checkpoint_interval);
+        writeUint32(out, static_cast<uint32_t>(checkpoints.size()));
+        for (uint64_t checkpoint : checkpoints) {
+            writeUint64(out, checkpoint);
+        }
+    }
+    out.reserve(out.size() + (code_bits + 7) / 8);
+    writeCodes(data, table, counts, threads, out);
+}
+
+inline void Huffman::decompressFramed(const std::vector<uint8_t>& data, std::vector<uint8_t>& out,
+                                      unsigned threads) {
+    if (data.size() < 16) {
+        throw std::runtime_error("Invalid Huffman compressed file format");
+    }
+
+    uint64_t original_bits = readUint64(data, 0);
+    uint64_t tree_size = readUint64(data, 8);
+    bool checkpointed = tree_size & CHECKPOINTED;
+    tree_size &= ~CHECKPOINTED;
+
+    if (data.size() - 16 < tree_size) {
+        throw std::runtime_error("Corrupted Huffman compressed file");
+    }
+
+    ArenaScope scope;
+    size_t offset = 16;
+    auto tree = readTree(data.data(), 16 + tree_size, offset);
+    if (!checkpointed) {
+        decodeBits(data.data() + 16 + tree_size, data.size() - 16 - tree_size, tree.get(), original_bits, out);
+        return;
+    }
+
+    size_t table = 16 + tree_size;
+    if (data.size() - table < 16) {
+        throw std::runtime_error("Corrupted Huffman checkpoint table");
+    }
+    uint64_t symbols = readUint64(data, table);
+    uint32_t interval = readUint32(data, table + 8);
+    uint32_t count = readUint32(data, table + 12);
+    size_t codes = table + 16 + 8 * static_cast<size_t>(count);
+    // Every symbol takes at least one bit, which bounds the output size.
+    if (interval == 0 || data.size() < codes || symbols > original_bits ||
+        count != (symbols == 0 ? 0 : (symbols - 1) / interval) || (original_bits + 7) / 8 > data.size() - codes) {
+        throw std::runtime_error("Corrupted Huffman checkpoint table");
+    }
+
+    out.clear();
+    if (symbols == 0) {
+        return;
+    }
+    ArenaVector<uint64_t> bounds(count + 2);
+    for (uint32_t k = 1; k <= count; k++) {
+        bounds[k] = readUint64(data, table + 16 + 8 * (k - 1));
+    }
+    bounds[count + 1] = original_bits;
+    for (uint32_t k = 0; k <= count; k++) {
+        if (bounds[k] > bounds[k + 1]) {
+            throw std::runtime_error("Corrupted Huffman checkpoint table");
+        }
+    }
+
+    PhaseTimer timer("huffman.decode", data.size() - codes);
+    out.resize(symbols);
+    Parallel::forEach(count + 1, threads, [&](size_t segment) {
+        size_t first = segment * interval;
+        decodeRange(data.data() + codes, bounds[segment], bounds[segment + 1], tree.get(), out.data() + first,
+                    std::min<uint64_t>(interval, symbols - first));
+    });
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef LEVEL_HPP
+#define LEVEL_HPP
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "pipeline.hpp"
+
+enum class Target {
+    Speed,
+    Balanced,
+    Ratio,
+};
+
+// Compression levels 1 (fastest) to 9 (smallest). Each level sets the block
+// size, how hard -a auto searches, and per-codec knobs:
+//   - LZW: maximum code width (narrower tables stay in cache) and whether a
+//     full dictionary is reset or frozen
+//   - Huffman: maximum code length (0 = unlimited) and whether to record
+//     checkpoints, which let one of the larger blocks decode on several
+//     threads
+struct CompressionLevel {
+    static constexpr int MIN = 1;
+    static constexpr int MAX = 9;
+    static constexpr int DEFAULT = 6;
+
+    int level;
+    size_t block_size;
+    Target target;
+    int lzw_max_bits;
+    bool lzw_reset;
+    int huffman_max_length;
+    bool huffman_checkpoints;
+
+    static CompressionLevel get(int level) {
+        static const CompressionLevel levels[] = {
+            {1, 128 * 1024, Target::Speed, 12, true, 12, false},
+            {2, 256 * 1024, Target::Speed, 12, true, 12, false},
+            {3, 256 * 1024, Target::Speed, 13, true, 13, false},
+            {4, 512 * 1024, Target::Balanced, 14, true, 15, false},
+            {5, 1024 * 1024, Target::Balanced, 15, true, 15, false},
+            {6, 1024 * 1024, Target::Balanced, 16, true, 0, false},
+            {7, 2048 * 1024, Target::Ratio, 16, true, 0, true},
+            {8, 4096 * 1024, Target::Ratio, 16, true, 0, true},
+            {9, 8192 * 1024, Target::Ratio, 16, true, 0, true},
+        };
+        if (level < MIN || level > MAX) {
+            throw std::runtime_error("Compression level must be between 1 and 9");
+        }
+        return levels[level - 1];
+    }
+
+    static Target parseTarget(const std::string& name) {
+        if (name == "speed") return Target::Speed;
+        if (name == "balanced") return Target::Balanced;
+        if (name == "ratio") return Target::Ratio;
+        throw std::runtime_error("Unknown target: " + name);
+    }
+
+    // Sets each stage's option to this level's knobs.
+    std::vector<StageSpec> configure(std::vector<StageSpec> specs) const {
+        for (StageSpec& spec : specs) {
+            if (spec.id == StageId::LZW) {
+                spec.option = LZWStage::option(lzw_max_bits, lzw_reset);
+            } else if (spec.id == StageId::Huffman) {
+                spec.option = HuffmanStage::option(huffman_max_length, huffman_checkpoints);
+            }
+        }
+        return specs;
+    }
+};
+
+#endif
@@ -1,94 +1,291 @@
 #ifndef LZW_HPP
 #define LZW_HPP
 
+#include <algorithm>
 #include <vector>
-#include <string>
-#include <unordered_map>
 #include <cstdint>
+#include <stdexcept>
+
+#include "arena.hpp"
+#include "stats.hpp"
 
 class LZW {
 public:
+    // Codes are written as 16 bits, so the dictionary stops growing once
+    // every code is taken. Decoders that keep growing stay compatible: the
+    // extra entries are never referenced.
+    static constexpr int MAX_DICT_SIZE = 1 << 16;
+
     static std::vector<uint8_t> compress(const std::vector<uint8_t>& data) {
-        std::unordered_map<std::string, int> dictionary;
-        for (int i = 0; i < 256; i++) {
-            dictionary[std::string(1, static_cast<char>(i))] = i;
-        }
+        std::vector<uint8_t> compressed;
+        compress(data, compressed);
+        return compressed;
+    }
 
-        std::string current;
-        std::vector<int> result;
-        int dict_size = 256;
+    static std::vector<uint8_t> decompress(const std::vector<uint8_t>& data) {
+        std::vector<uint8_t> decompressed;
+        decompress(data, decompressed);
+        return decompressed;
+    }
 
-        for (uint8_t byte : data) {
-            std::string next = current + static_cast<char>(byte);
+    static std::vector<uint8_t> compress(const std::vector<uint8_t>& data, int max_bits, bool reset) {
+        std::vector<uint8_t> compressed;
+        compress(data, max_bits, reset, compressed);
+        return compressed;
+    }
 
-            if (dictionary.find(next) != dictionary.end()) {
-                current = next;
-            } else {
-                result.push_back(dictionary[current]);
-                dictionary[next] = dict_size++;
-                current = std::string(1, static_cast<char>(byte));
-            }
-        }
+    static std::vector<uint8_t> decompress(const std::vector<uint8_t>& data, int max_bits, bool reset) {
+        std::vector<uint8_t> decompressed;
+        decompress(data, max_bits, reset, decompressed);
+        return decompressed;
+    }
 
-        if (!current.empty()) {
-            result.push_back(dictionary[current]);
-        }
+    // The overloads below overwrite their output, reusing its capacity. The
+    // dictionaries are scratch in the thread's arena (arena.hpp), released
+    // in one step when the call returns.
 
-        std::vector<uint8_t> compressed;
-        for (int code : result) {
+    // Fixed 16-bit codes. The dictionary is keyed by (prefix code, byte),
+    // which gives the same codes as keying by the whole string.
+    static void compress(const std::vector<uint8_t>& data, std::vector<uint8_t>& compressed) {
+        PhaseTimer timer("lzw.encode", data.size());
+        ArenaScope scope;
+        ArenaHashMap<uint32_t, int> dictionary;
+        dictionary.reserve(std::min<size_t>(data.size(), MAX_DICT_SIZE));
+        compressed.clear();
+        compressed.reserve(data.size());
+
+        auto emit = [&](int code) {
             compressed.push_back(static_cast<uint8_t>(code & 0xFF));
             compressed.push_back(static_cast<uint8_t>((code >> 8) & 0xFF));
+        };
+
+        int dict_size = 256;
+        int current = -1;
+        for (uint8_t byte : data) {
+            if (current < 0) {
+                current = byte;
+                continue;
+            }
+            uint32_t key = (static_cast<uint32_t>(current) << 8) | byte;
+            auto found = dictionary.find(key);
+            if (found != dictionary.end()) {
+                current = found->second;
+                continue;
+            }
+            emit(current);
+            if (dict_size < MAX_DICT_SIZE) {
+                dictionary.emplace(key, dict_size++);
+            }
+            current = byte;
+        }
+        if (current >= 0) {
+            emit(current);
         }
-        return compressed;
     }
-    
-    static std::vector<uint8_t> decompress(const std::vector<uint8_t>& data) {
-        if (data.size() % 2 != 0) return {};
 
-        std::unordered_map<int, std::string> dictionary;
-        for (int i = 0; i < 256; i++) {
-            dictionary[i] = std::string(1, static_cast<char>(i));
+    // Malformed input decodes to nothing rather than throwing, as this
+    // format always has.
+    static void decompress(const std::vector<uint8_t>& data, std::vector<uint8_t>& decompressed) {
+        decompressed.clear();
+        if (data.size() % 2 != 0) {
+            return;
         }
+        PhaseTimer timer("lzw.decode", data.size());
+        ArenaScope scope;
+        ArenaVector<int> prefix(MAX_DICT_SIZE);
+        ArenaVector<uint8_t> suffix(MAX_DICT_SIZE);
+        ArenaVector<uint8_t> entry;
 
-        std::vector<int> codes;
+        int dict_size = 256;
+        int previous = -1;
         for (size_t i = 0; i < data.size(); i += 2) {
             int code = data[i] | (data[i + 1] << 8);
-            codes.push_back(code);
+            if (previous < 0) {
+                if (code >= 256) {
+                    decompressed.clear();
+                    return;
+                }
+                emit(code, prefix, suffix, entry, decompressed);
+            } else if (code < dict_size) {
+                uint8_t first = emit(code, prefix, suffix, entry, decompressed);
+                if (dict_size < MAX_DICT_SIZE) {
+                    prefix[dict_size] = previous;
+                    suffix[dict_size++] = first;
+                }
+            } else if (code == dict_size && dict_size < MAX_DICT_SIZE) {
+                int walk = previous;
+                while (walk >= 256) {
+                    walk = prefix[walk];
+                }
+                prefix[dict_size] = previous;
+                suffix[dict_size++] = static_cast<uint8_t>(walk);
+                emit(code, prefix, suffix, entry, decompressed);
+            } else {
+                decompressed.clear();
+                return;
+            }
+            previous = code;
         }
+    }
 
-        if (codes.empty()) {
-            return {};
-        }
+    // Variable-width variant: codes start at 9 bits and grow with the
+    // dictionary up to `max_bits`, packed least significant bit first. A
+    // full dictionary is frozen, or with `reset` cleared so it can adapt.
+    static void compress(const std::vector<uint8_t>& data, int max_bits, bool reset,
+                         std::vector<uint8_t>& compressed) {
+        checkWidth(max_bits);
+        PhaseTimer timer("lzw.encode", data.size());
+        ArenaScope scope;
+        const int max_size = 1 << max_bits;
 
-        std::string current = dictionary[codes[0]];
-        std::vector<uint8_t> result;
+        ArenaHashMap<uint32_t, int> dictionary;
+        dictionary.reserve(std::min<size_t>(data.size(), max_size));
+        compressed.clear();
+        compressed.reserve(data.size() / 2);
+        BitPacker packer{compressed};
 
-        for (char c : current) {
-            result.push_back(static_cast<uint8_t>(c));
+        int dict_size = 256;
+        int current = -1;
+        for (uint8_t byte : data) {
+            if (current < 0) {
+                current = byte;
+                continue;
+            }
+            uint32_t key = (static_cast<uint32_t>(current) << 8) | byte;
+            auto found = dictionary.find(key);
+            if (found != dictionary.end()) {
+                current = found->second;
+                continue;
+            }
+            packer.write(current, codeWidth(dict_size));
+            if (dict_size < max_size) {
+                dictionary.emplace(key, dict_size++);
+                if (reset && dict_size == max_size) {
+                    dictionary.clear();
+                    dict_size = 256;
+                }
+            }
+            current = byte;
+        }
+        if (current >= 0) {
+            packer.write(current, codeWidth(dict_size));
         }
+        packer.flush();
+    }
 
-        int dict_size = 256;
+    static void decompress(const std::vector<uint8_t>& data, int max_bits, bool reset,
+                           std::vector<uint8_t>& result) {
+        checkWidth(max_bits);
+        PhaseTimer timer("lzw.decode", data.size());
+        ArenaScope scope;
+        const int max_size = 1 << max_bits;
 
-        for (size_t i = 1; i < codes.size(); i++) {
-            int code = codes[i];
-            std::string entry;
+        ArenaVector<int> prefix(max_size);
+        ArenaVector<uint8_t> suffix(max_size);
+        ArenaVector<uint8_t> entry;
+        result.clear();
+
+        size_t bit_position = 0;
+        const size_t total_bits = data.size() * 8;
+        int dict_size = 256;
+        int previous = -1;
+        while (true) {
+            // The encoder is one entry ahead: it adds an entry as it emits a
+            // code, the decoder only when the next code arrives.
+            int encoder_size = std::min(dict_size + (previous >= 0 ? 1 : 0), max_size);
+            if (reset && encoder_size == max_size && previous >= 0) {
+                dict_size = 256;
+                previous = -1;
+                encoder_size = 256;
+            }
+            int width = codeWidth(encoder_size);
+            if (total_bits - bit_position < static_cast<size_t>(width)) {
+                break;
+            }
+            int code = 0;
+            for (int bit = 0; bit < width; bit++, bit_position++) {
+                code |= ((data[bit_position >> 3] >> (bit_position & 7)) & 1) << bit;
+            }
 
-            if (dictionary.find(code) != dictionary.end()) {
-                entry = dictionary[code];
-            } else if (code == dict_size) {
-                entry = current + current[0];
+            if (previous < 0) {
+                if (code >= 256) {
+                    throw std::runtime_error("Invalid LZW code");
+                }
+                emit(code, prefix, suffix, entry, result);
+            } else if (code < dict_size) {
+                uint8_t first = emit(code, prefix, suffix, entry, result);
+                if (dict_size < max_size) {
+                    prefix[dict_size] = previous;
+                    suffix[dict_size++] = first;
+                }
+            } else if (code == dict_size && dict_size < max_size) {
+                int walk = previous;
+                while (walk >= 256) {
+                    walk = prefix[walk];
+                }
+                prefix[dict_size] = previous;
+                suffix[dict_size++] = static_cast<uint8_t>(walk);
+                emit(code, prefix, suffix, entry, result);
             } else {
-                return {};
+                throw std::runtime_error("Invalid LZW code");
             }
+            previous = code;
+        }
+    }
+
+private:
+    // Appends the entry for `code` to `out` and returns its first byte.
+    // `entry` is scratch for the reversed walk up the prefix chain.
+    static uint8_t emit(int code, const ArenaVector<int>& prefix, const ArenaVector<uint8_t>& suffix,
+                        ArenaVector<uint8_t>& entry, std::vector<uint8_t>& out) {
+        entry.clear();
+        while (code >= 256) {
+            entry.push_back(suffix[code]);
+            code = prefix[code];
+        }
+        entry.push_back(static_cast<uint8_t>(code));
+        out.insert(out.end(), entry.rbegin(), entry.rend());
+        return static_cast<uint8_t>(code);
+    }
+
+    struct BitPacker {
+        std::vector<uint8_t>& out;
+        uint64_t accumulator = 0;
+        int pending = 0;
 
-            for (char c : entry) {
-                result.push_back(static_cast<uint8_t>(c));
+        void write(int code, int width) {
+            accumulator |= static_cast<uint64_t>(code) << pending;
+            pending += width;
+            while (pending >= 8) {
+                out.push_back(static_cast<uint8_t>(accumulator & 0xFF));
+                accumulator >>= 8;
+                pending -= 8;
             }
+        }
+
+        void flush() {
+            if (pending > 0) {
+                out.push_back(static_cast<uint8_t>(accumulator & 0xFF));
+                accumulator = 0;
+                pending = 0;
+            }
+        }
+    };
+
+    static void checkWidth(int max_bits) {
+        if (max_bits < 9 || max_bits > 16) {
+            throw std::runtime_error("LZW code width must be between 9 and 16 bits");
+        }
+    }
 
-            dictionary[dict_size++] = current + entry[0];
-            current = entry;
+    // Bits needed for the largest code an encoder holding `size` entries
+    // can emit.
+    static int codeWidth(int size) {
+        int width = 9;
+        while ((1 << width) < size) {
+            width++;
         }
-        return result;
+        return width;
     }
 };
 
@@ -0,0 +1,151 @@
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Where worker threads run and where their memory comes from.
+//   off:        leave both to the kernel
+//   local:      pin each worker to one core, spreading workers across
+//               nodes, and prefer that core's node for its allocations
+//   interleave: spread worker allocations page by page over all nodes
+enum class NumaPolicy { Off, Local, Interleave };
+
+// Node topology from /sys and placement through sched_setaffinity(2) and
+// set_mempolicy(2), without libnuma. Pages land on the node of the thread
+// that first touches them, so a pinned worker that builds its own buffers
+// and codec tables gets them locally. With one node, or where the kernel
+// refuses, every policy degrades to off.
+class Numa {
+public:
+    struct Node {
+        int id;
+        std::vector<int> cpus;  // only those this process may run on
+    };
+
+    static NumaPolicy parsePolicy(const std::string& name) {
+        if (name == "off") return NumaPolicy::Off;
+        if (name == "local") return NumaPolicy::Local;
+        if (name == "interleave") return NumaPolicy::Interleave;
+        throw std::runtime_error("Unknown NUMA policy: " + name);
+    }
+
+    // Online nodes with at least one usable CPU, read once.
+    static const std::vector<Node>& nodes() {
+        static const std::vector<Node> topology = discover();
+        return topology;
+    }
+
+    // Applies `policy` to the calling thread as worker `worker`. Returns
+    // the node it was placed on, or -1 if it was left alone.
+    static int place(NumaPolicy policy, unsigned worker) {
+        const std::vector<Node>& all = nodes();
+        if (policy == NumaPolicy::Off || all.size() < 2) {
+            return -1;
+        }
+#ifdef __linux__
+        if (policy == NumaPolicy::Interleave) {
+            std::vector<int> ids;
+            for (const Node& node : all) {
+                ids.push_back(node.id);
+            }
+            setMemoryPolicy(MPOL_INTERLEAVE, ids);
+            return -1;
+        }
+
+        const Node& node = all[worker % all.size()];
+        int cpu = node.cpus[(worker / all.size()) % node.cpus.size()];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            return -1;
+        }
+        setMemoryPolicy(MPOL_PREFERRED, {node.id});
+        return node.id;
+#else
+        (void)worker;
+        return -1;
+#endif
+    }
+
+private:
+    static std::vector<Node> discover() {
+        std::vector<Node> found;
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return found;
+        }
+        for (int id : parseList(readLine("/sys/devices/system/node/online"))) {
+            Node node{id, {}};
+            for (int cpu : parseList(readLine("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist"))) {
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                    node.cpus.push_back(cpu);
+                }
+            }
+            if (!node.cpus.empty()) {
+                found.push_back(node);
+            }
+        }
+#endif
+        return found;
+    }
+
+    static std::string readLine(const std::string& path) {
+        std::ifstream file(path);
+        std::string line;
+        std::getline(file, line);
+        return line;
+    }
+
+    // Kernel list format: "0-3,8,10-11".
+    static std::vector<int> parseList(const std::string& text) {
+        std::vector<int> values;
+        std::stringstream stream(text);
+        std::string range;
+        while (std::getline(stream, range, ',')) {
+            if (range.empty()) {
+                continue;
+            }
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int value = first; value <= last; value++) {
+                values.push_back(value);
+            }
+        }
+        return values;
+    }
+
+#ifdef __linux__
+    // Failure leaves the thread on the default policy, which is still correct.
+    static void setMemoryPolicy(int mode, const std::vector<int>& ids) {
+        constexpr size_t BITS = 8 * sizeof(unsigned long);
+        std::vector<unsigned long> mask;
+        for (int id : ids) {
+            size_t word = static_cast<size_t>(id) / BITS;
+            if (mask.size() <= word) {
+                mask.resize(word + 1, 0);
+            }
+            mask[word] |= 1ul << (static_cast<size_t>(id) % BITS);
+        }
+        syscall(SYS_set_mempolicy, mode, mask.data(), mask.size() * BITS + 1);
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Fork-join helpers for codecs that split one buffer across threads.
+// `threads` follows one convention everywhere: 0 means one per hardware
+// thread, 1 runs inline on the caller.
+class Parallel {
+public:
+    static unsigned resolve(unsigned threads) {
+        return threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : threads;
+    }
+
+    // Calls fn(i) for every i in [0, count), spread over up to `threads`
+    // threads. The first exception thrown stops further work and is
+    // rethrown on the caller once all threads have joined.
+    template <typename Fn>
+    static void forEach(size_t count, unsigned threads, Fn fn) {
+        threads = static_cast<unsigned>(std::min<size_t>(resolve(threads), count));
+        if (threads <= 1) {
+            for (size_t i = 0; i < count; i++) {
+                fn(i);
+            }
+            return;
+        }
+
+        std::atomic<size_t> next{0};
+        std::exception_ptr error;
+        std::atomic<bool> failed{false};
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&]() {
+                for (size_t i; (i = next.fetch_add(1)) < count && !failed; ) {
+                    try {
+                        fn(i);
+                    } catch (...) {
+                        if (!failed.exchange(true)) {
+                            error = std::current_exception();
+                        }
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Splits [0, size) into `parts` contiguous ranges of near-equal length;
+    // returns the start of part `index` (index == parts gives `size`).
+    static size_t split(size_t size, size_t parts, size_t index) {
+        return size / parts * index + size % parts * index / parts;
+    }
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware performance counters for the calling thread, read straight from
+// perf_event_open(2) with no external tools. The events form one group so
+// a single read() returns them all; events the CPU, kernel or
+// perf_event_paranoid setting refuses are skipped and read as zero, and if
+// none open at all available() is false with the reason in error().
+// User-space counts only, so unprivileged processes can use them.
+class PerfCounters {
+public:
+    enum Event {
+        CYCLES,
+        INSTRUCTIONS,
+        BRANCH_MISSES,
+        L1D_MISSES,
+        LLC_MISSES,
+        DTLB_MISSES,
+        COUNT,
+    };
+    using Values = std::array<uint64_t, COUNT>;
+
+    static const char* name(int event) {
+        static const char* const names[COUNT] = {"cycles",     "instructions", "branch_misses",
+                                                 "l1d_misses", "llc_misses",   "dtlb_misses"};
+        return names[event];
+    }
+
+    // Counters are per thread, so each thread opens its own group on first use.
+    static PerfCounters& local() {
+        thread_local PerfCounters counters;
+        return counters;
+    }
+
+    bool available() const { return !order_.empty(); }
+    bool has(int event) const { return opened_[event]; }
+    const std::string& error() const { return error_; }
+
+    // Current counts, scaled up if the kernel had to multiplex the group.
+    Values read() const {
+        Values values{};
+#ifdef __linux__
+        if (order_.empty()) {
+            return values;
+        }
+        // Layout with PERF_FORMAT_GROUP: nr, time enabled, time running, values.
+        uint64_t buffer[3 + COUNT] = {};
+        ssize_t size = ::read(leader_, buffer, sizeof(buffer));
+        if (size < static_cast<ssize_t>(3 * sizeof(uint64_t)) || buffer[0] != order_.size()) {
+            return values;
+        }
+        double scale = buffer[2] > 0 && buffer[2] < buffer[1] ? static_cast<double>(buffer[1]) / buffer[2] : 1.0;
+        for (size_t i = 0; i < order_.size(); i++) {
+            values[order_[i]] = static_cast<uint64_t>(buffer[3 + i] * scale);
+        }
+#endif
+        return values;
+    }
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (int fd : fds_) {
+            close(fd);
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+private:
+    int leader_ = -1;
+    std::vector<int> fds_;
+    std::vector<int> order_;  // events in group read order
+    std::array<bool, COUNT> opened_{};
+    std::string error_;
+
+    PerfCounters() {
+#ifdef __linux__
+        for (int event = 0; event < COUNT; event++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            configure(event, attr);
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0));
+            if (fd < 0) {
+                if (error_.empty()) {
+                    error_ = describe(event, errno);
+                }
+                continue;
+            }
+            if (leader_ < 0) {
+                leader_ = fd;
+            }
+            fds_.push_back(fd);
+            order_.push_back(event);
+            opened_[event] = true;
+        }
+        if (!order_.empty()) {
+            error_.clear();
+        }
+#else
+        error_ = "hardware counters need Linux perf_event_open";
+#endif
+    }
+
+#ifdef __linux__
+    static void configure(int event, perf_event_attr& attr) {
+        auto cache = [&](uint64_t cache_id) {
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache_id | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        };
+        attr.type = PERF_TYPE_HARDWARE;
+        switch (event) {
+            case CYCLES: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+            case INSTRUCTIONS: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+            case BRANCH_MISSES: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+            case L1D_MISSES: cache(PERF_COUNT_HW_CACHE_L1D); break;
+            case LLC_MISSES: cache(PERF_COUNT_HW_CACHE_LL); break;
+            case DTLB_MISSES: cache(PERF_COUNT_HW_CACHE_DTLB); break;
+        }
+    }
+
+    static std::string describe(int event, int error) {
+        std::string reason = std::string(name(event)) + ": " + std::strerror(error);
+        if (error == EACCES || error == EPERM) {
+            reason += " (see /proc/sys/kernel/perf_event_paranoid)";
+        } else if (error == ENOENT || error == EOPNOTSUPP) {
+            reason += " (no hardware counters, e.g. inside a VM)";
+        }
+        return reason;
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bytes.hpp"
+#include "bwt.hpp"
+#include "huffman.hpp"
+#include "lzw.hpp"
+#include "rle.hpp"
+
+// Chains codecs into a pipeline (e.g. "rle,huffman") that encodes and
+// decodes one block at a time through two reusable buffers. An empty
+// pipeline stores blocks unchanged. The file format lives in container.hpp.
+enum class StageId : uint8_t {
+    RLE = 1,
+    Huffman = 2,
+    LZW = 3,
+    BWT = 4,
+};
+
+// A stage plus its option byte, which is recorded in the container so the
+// decoder can rebuild the stage exactly. Option 0 is each codec's default.
+struct StageSpec {
+    StageId id;
+    uint8_t option = 0;
+
+    StageSpec(StageId stage_id, uint8_t stage_option = 0) : id(stage_id), option(stage_option) {}
+
+    bool operator<(const StageSpec& other) const {
+        return id != other.id ? id < other.id : option < other.option;
+    }
+    bool operator==(const StageSpec& other) const { return id == other.id && option == other.option; }
+};
+
+class Stage {
+public:
+    explicit Stage(uint8_t option) : option_(option) {}
+    virtual ~Stage() = default;
+    virtual StageId id() const = 0;
+    // `threads` is how many threads the codec may use within the block
+    // (see Parallel::resolve); codecs without a parallel path ignore it.
+    virtual void encode(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, unsigned threads) = 0;
+    virtual void decode(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, unsigned threads) = 0;
+    // Whether encoding (or decoding) splits one block over `threads`.
+    virtual bool threaded(bool) const { return false; }
+
+    StageSpec spec() const { return {id(), option_}; }
+
+    static std::unique_ptr<Stage> create(const StageSpec& spec);
+
+    static const char* name(StageId id) {
+        switch (id) {
+            case StageId::RLE: return "rle";
+            case StageId::Huffman: return "huffman";
+            case StageId::LZW: return "lzw";
+            case StageId::BWT: return "bwt";
+        }
+        return "unknown";
+    }
+
+    static StageId fromName(const std::string& name) {
+        for (StageId id : {StageId::RLE, StageId::Huffman, StageId::LZW, StageId::BWT}) {
+            if (name == Stage::name(id)) {
+                return id;
+            }
+        }
+        throw std::runtime_error("Unknown algorithm: " + name);
+    }
+
+protected:
+    uint8_t option_;
+};
+
+class RLEStage : public Stage {
+public:
+    using Stage::Stage;
+    StageId id() const override { return StageId::RLE; }
+    bool threaded(bool) const override { return true; }
+    void encode(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, unsigned threads) override {
+        RLE::compress(in, out, threads);
+    }
+    void decode(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, unsigned threads) override {
+        RLE::decompress(in, out, threads);
+    }
+};
+
+// Option: the low bits give the maximum code length in bits, 0 for
+// unlimited; CHECKPOINTS records decoding checkpoints so one block can be
+// decoded on several threads. Both travel with the data, so decoding does
+// not depend on the option.
+class HuffmanStage : public Stage {
+public:
+    static constexpr uint8_t LENGTH_MASK = 0x7F;
+    static constexpr uint8_t CHECKPOINTS = 0x80;
+
+    using Stage::Stage;
+    StageId id() const override { return StageId::Huffman; }
+    // Decoding splits only at the checkpoints.
+    bool threaded(bool encode) const override { return encode || (option_ & CHECKPOINTS); }
+    void encode(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, unsigned threads) override {
+        uint32_t interval = (option_ & CHECKPOINTS) ? Huffman::DEFAULT_CHECKPOINT_INTERVAL : 0;
+        Huffman::compressFramed(in, out, option_ & LENGTH_MASK, threads, interval);
+    }
+    void decode(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, unsigned threads) override {
+        Huffman::decompressFramed(in, out, threads);
+    }
+
+    static uint8_t option(int max_length, bool checkpoints) {
+        return static_cast<uint8_t>(max_length | (checkpoints ? CHECKPOINTS : 0));
+    }
+};
+
+// Option 0: fixed 16-bit codes. Otherwise the low bits give the maximum
+// width of variable-width codes and RESET clears a full dictionary.
+class LZWStage : public Stage {
+public:
+    static constexpr uint8_t WIDTH_MASK = 0x1F;
+    static constexpr uint8_t RESET = 0x20;
+
+    using Stage::Stage;
+    StageId id() const override { return StageId::LZW; }
+    void encode(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, unsigned) override {
+        if (option_ == 0) {
+            LZW::compress(in, out);
+        } else {
+            LZW::compress(in, option_ & WIDTH_MASK, option_ & RESET, out);
+        }
+    }
+    void decode(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, unsigned) override {
+        if (option_ == 0) {
+            LZW::decompress(in, out);
+        } else {
+            LZW::decompress(in, option_ & WIDTH_MASK, option_ & RESET, out);
+        }
+    }
+
+    static uint8_t option(int max_bits, bool reset) {
+        return static_cast<uint8_t>(max_bits | (reset ? RESET : 0));
+    }
+};
+
+class BWTStage : public Stage {
+public:
+    using Stage::Stage;
+    StageId id() const override { return StageId::BWT; }
+    // Pipeline blocks are already independent, so each is sorted as one BWT block.
+    void encode(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, unsigned) override {
+        out = BWT::compress(in, std::max<size_t>(in.size(), 1), 1);
+    }
+    void decode(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, unsigned) override {
+        out = BWT::decompress(in, 1);
+    }
+};
+
+inline std::unique_ptr<Stage> Stage::create(const StageSpec& spec) {
+    switch (spec.id) {
+        case StageId::RLE: return std::make_unique<RLEStage>(spec.option);
+        case StageId::Huffman: return std::make_unique<HuffmanStage>(spec.option);
+        case StageId::LZW: return std::make_unique<LZWStage>(spec.option);
+        case StageId::BWT: return std::make_unique<BWTStage>(spec.option);
+    }
+    throw std::runtime_error("Unknown stage id: " + std::to_string(static_cast<int>(spec.id)));
+}
+
+class Pipeline {
+public:
+    explicit Pipeline(const std::vector<StageSpec>& specs) {
+        if (specs.size() > 254) {
+            throw std::runtime_error("Pipeline has too many stages");
+        }
+        for (const StageSpec& spec : specs) {
+            stages_.push_back(Stage::create(spec));
+        }
+    }
+
+    // Parses a comma-separated stage list. "bwt" on its own is shorthand for
+    // "bwt,huffman", since the transform alone does not compress; "stored"
+    // is the empty pipeline.
+    static std::vector<StageSpec> parseSpecs(const std::string& spec) {
+        if (spec == "bwt") {
+            return {StageId::BWT, StageId::Huffman};
+        }
+        std::vector<StageSpec> specs;
+        if (spec == "stored") {
+            return specs;
+        }
+        std::stringstream stream(spec);
+        std::string name;
+        while (std::getline(stream, name, ',')) {
+            specs.push_back(Stage::fromName(name));
+        }
+        return specs;
+    }
+
+    static Pipeline parse(const std::string& spec) {
+        return Pipeline(parseSpecs(spec));
+    }
+
+    std::vector<StageSpec> specs() const {
+        std::vector<StageSpec> result;
+        for (const auto& stage : stages_) {
+            result.push_back(stage->spec());
+        }
+        return result;
+    }
+
+    std::string describe() const {
+        if (stages_.empty()) {
+            return "stored";
+        }
+        std::string description;
+        for (const auto& stage : stages_) {
+            if (!description.empty()) {
+                description += "+";
+            }
+            description += Stage::name(stage->id());
+        }
+        return description;
+    }
+
+    // Whether every stage splits a block over threads, so one block at a
+    // time can keep them all busy.
+    bool threaded(bool encode) const {
+        return !stages_.empty() && std::all_of(stages_.begin(), stages_.end(),
+                                               [&](const auto& stage) { return stage->threaded(encode); });
+    }
+
+    // Runs one block through every stage. `scratch` is the second of the two
+    // buffers the stages alternate between; `threads` is passed to each.
+    void encodeBlock(const std::vector<uint8_t>& raw, std::vector<uint8_t>& encoded,
+                     std::vector<uint8_t>& scratch, unsigned threads = 1) const {
+        runStages(true, raw, encoded, scratch, threads);
+    }
+
+    void decodeBlock(const std::vector<uint8_t>& encoded, std::vector<uint8_t>& raw,
+                     std::vector<uint8_t>& scratch, unsigned threads = 1) const {
+        runStages(false, encoded, raw, scratch, threads);
+    }
+
+private:
+    std::vector<std::unique_ptr<Stage>> stages_;
+
+    void runStages(bool encode, const std::vector<uint8_t>& in, std::vector<uint8_t>& out,
+                   std::vector<uint8_t>& scratch, unsigned threads) const {
+        size_t count = stages_.size();
+        if (count == 0) {
+            out.assign(in.begin(), in.end());
+            return;
+        }
+        const std::vector<uint8_t>* current = &in;
+        for (size_t i = 0; i < count; i++) {
+            // Alternate buffers so that the final stage lands in `out`.
+            std::vector<uint8_t>& next = ((count - i) % 2 == 1) ? out : scratch;
+            if (encode) {
+                stages_[i]->encode(*current, next, threads);
+            } else {
+                stages_[count - 1 - i]->decode(*current, next, threads);
+            }
+            current = &next;
+        }
+    }
+};
+
+// Lazily built pipelines keyed by stage list, so per-block codec choices do
+// not construct stages for every block.
+class PipelineCache {
+public:
+    const Pipeline& get(const std::vector<StageSpec>& specs) {
+        auto found = pipelines_.find(specs);
+        if (found == pipelines_.end()) {
+            found = pipelines_.emplace(specs, Pipeline(specs)).first;
+        }
+        return found->second;
+    }
+
+private:
+    std::map<std::vector<StageSpec>, Pipeline> pipelines_;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef QUEUE_HPP
+#define QUEUE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+// Bounded lock-free queues for handing blocks between threads. Both hold
+// a power-of-two number of slots (the capacity is rounded up) and never
+// allocate after construction. tryPush/tryPop fail instead of blocking;
+// callers that must wait retry with a Backoff.
+
+// Waits between retries: spins briefly, then yields, then sleeps, so a
+// thread stalled on a slow disk does not burn a core.
+class Backoff {
+public:
+    void pause() {
+        if (rounds_ < 16) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        } else if (rounds_ < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        rounds_++;
+    }
+
+    void reset() { rounds_ = 0; }
+
+private:
+    int rounds_ = 0;
+};
+
+inline size_t queueSlots(size_t capacity) {
+    size_t slots = 1;
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+// One producer thread, one consumer thread. Each side caches the other's
+// index and only reloads it when the ring looks full or empty.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity)
+        : size_(queueSlots(capacity)), mask_(size_ - 1), slots_(new T[size_]) {}
+
+    bool tryPush(const T& value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ == size_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ == size_) {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+        value = slots_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    const size_t size_;
+    const size_t mask_;
+    std::unique_ptr<T[]> slots_;
+    alignas(64) std::atomic<size_t> head_{0};  // consumer side
+    size_t tail_cache_ = 0;
+    alignas(64) std::atomic<size_t> tail_{0};  // producer side
+    size_t head_cache_ = 0;
+};
+
+// Any number of producers and consumers (Vyukov's bounded queue). Each
+// slot's sequence number says whether it is ready to be written for the
+// current lap or read, so a push or pop is one CAS on its index.
+template <typename T>
+class MpmcQueue {
+public:
+    explicit MpmcQueue(size_t capacity) : size_(queueSlots(capacity)), mask_(size_ - 1), cells_(new Cell[size_]) {
+        for (size_t i = 0; i < size_; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool tryPush(const T& value) {
+        size_t position = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells_[position & mask_];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t lag = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (lag == 0) {
+                if (tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                position = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& value) {
+        size_t position = head_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells_[position & mask_];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t lag = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (lag == 0) {
+                if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.sequence.store(position + size_, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                position = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    const size_t size_;
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+#endif
@@ -1,16 +1,48 @@
 #ifndef RLE_HPP
 #define RLE_HPP
 
+#include <algorithm>
 #include <vector>
 #include <cstdint>
+#include <cstring>
+
+#include "arena.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
 
 class RLE {
 public:
-    static std::vector<uint8_t> compress(const std::vector<uint8_t>& data) {
+    // Inputs split over several threads (0 = one per core) only when each
+    // gets at least this many bytes.
+    static constexpr size_t MIN_PARALLEL_CHUNK = 64 * 1024;
+
+    static std::vector<uint8_t> compress(const std::vector<uint8_t>& data, unsigned threads = 1) {
         std::vector<uint8_t> compressed;
-        if (data.empty()) {
-            return compressed;
+        compress(data, compressed, threads);
+        return compressed;
+    }
+
+    static std::vector<uint8_t> decompress(const std::vector<uint8_t>& data, unsigned threads = 1) {
+        std::vector<uint8_t> decompressed;
+        decompress(data, decompressed, threads);
+        return decompressed;
+    }
+
+    // Overwrite `compressed` / `decompressed`, reusing their capacity, so a
+    // caller that keeps its buffers allocates nothing once they have grown.
+    //
+    // With several threads each encodes its own chunk. A run that crosses
+    // chunk boundaries is written, at its full length, by the chunk it
+    // starts in, so the bytes match the serial encoder.
+    static void compress(const std::vector<uint8_t>& data, std::vector<uint8_t>& compressed,
+                         unsigned threads = 1) {
+        PhaseTimer timer("rle.encode", data.size());
+        size_t chunks = chunkCount(data.size(), threads);
+        if (chunks > 1) {
+            compressParallel(data, compressed, chunks, threads);
+            return;
         }
+        compressed.clear();
         for (size_t i = 0; i < data.size(); ) {
             uint8_t current = data[i];
             size_t count = 1;
@@ -23,11 +55,20 @@ public:
             compressed.push_back(current);
             i += count;
         }
-        return compressed;
     }
 
-    static std::vector<uint8_t> decompress(const std::vector<uint8_t>& data) {
-        std::vector<uint8_t> decompressed;
+    // With several threads, each sums the counts of its share of the pairs;
+    // a prefix sum over those totals gives every share its slice of the
+    // presized output, which it fills with memset.
+    static void decompress(const std::vector<uint8_t>& data, std::vector<uint8_t>& decompressed,
+                           unsigned threads = 1) {
+        PhaseTimer timer("rle.decode", data.size());
+        size_t chunks = chunkCount(data.size(), threads);
+        if (chunks > 1) {
+            decompressParallel(data, decompressed, chunks, threads);
+            return;
+        }
+        decompressed.clear();
 
         for (size_t i = 0; i < data.size(); i += 2) {
             if (i + 1 >= data.size()) {
@@ -35,12 +76,147 @@ public:
             }
             uint8_t count = data[i];
             uint8_t value = data[i + 1];
-            for (int j = 0; j < count; j++) {
-                decompressed.push_back(value);
+            decompressed.insert(decompressed.end(), count, value);
+        }
+    }
+
+private:
+    static size_t chunkCount(size_t size, unsigned threads) {
+        return std::max<size_t>(1, std::min<size_t>(Parallel::resolve(threads), size / MIN_PARALLEL_CHUNK));
+    }
+
+    struct Chunk {
+        size_t begin;
+        size_t end;
+        size_t head;         // leading run, clipped to the chunk
+        size_t tail;         // trailing run, clipped to the chunk
+        uint64_t middle;     // pairs for the runs between head and tail
+        bool continues;      // the head run started in an earlier chunk
+        uint64_t owned;      // full length of the tail run if it starts here, else 0
+        uint64_t offset;     // where this chunk's pairs go in the output
+
+        bool uniform() const { return head == end - begin; }
+    };
+
+    static uint64_t pairsFor(uint64_t run) { return (run + 254) / 255; }
+
+    static uint8_t* writeRun(uint8_t* out, uint8_t value, uint64_t run) {
+        for (; run > 0; run -= std::min<uint64_t>(run, 255)) {
+            *out++ = static_cast<uint8_t>(std::min<uint64_t>(run, 255));
+            *out++ = value;
+        }
+        return out;
+    }
+
+    // Pairs the serial encoder emits for data[begin, end). With `out`, also
+    // writes them there.
+    static uint64_t encodeRange(const uint8_t* data, size_t begin, size_t end, uint8_t* out) {
+        uint64_t pairs = 0;
+        for (size_t i = begin; i < end; pairs++) {
+            size_t run = 1;
+            while (i + run < end && data[i + run] == data[i] && run < 255) {
+                run++;
+            }
+            if (out) {
+                *out++ = static_cast<uint8_t>(run);
+                *out++ = data[i];
             }
+            i += run;
         }
-        return decompressed;
+        return pairs;
+    }
+
+    static void compressParallel(const std::vector<uint8_t>& data, std::vector<uint8_t>& compressed,
+                                 size_t chunks, unsigned threads) {
+        ArenaScope scope;
+        ArenaVector<Chunk> parts(chunks);
+        const uint8_t* bytes = data.data();
+        Parallel::forEach(chunks, threads, [&](size_t index) {
+            Chunk& c = parts[index];
+            c.begin = Parallel::split(data.size(), chunks, index);
+            c.end = Parallel::split(data.size(), chunks, index + 1);
+            c.head = 1;
+            while (c.begin + c.head < c.end && bytes[c.begin + c.head] == bytes[c.begin]) {
+                c.head++;
+            }
+            c.tail = c.head;
+            c.middle = 0;
+            if (!c.uniform()) {
+                c.tail = 1;
+                while (bytes[c.end - 1 - c.tail] == bytes[c.end - 1]) {
+                    c.tail++;
+                }
+                c.middle = encodeRange(bytes, c.begin + c.head, c.end - c.tail, nullptr);
+            }
+        });
+
+        // Stitch runs across boundaries: a continuing head extends the open
+        // run, which stays open through chunks that hold nothing else.
+        size_t open = 0;
+        uint64_t total = 0;
+        for (size_t index = 0; index < chunks; index++) {
+            Chunk& c = parts[index];
+            c.continues = index > 0 && bytes[c.begin] == bytes[c.begin - 1];
+            c.owned = 0;
+            if (c.continues) {
+                parts[open].owned += c.head;
+                if (c.uniform()) {
+                    continue;
+                }
+            }
+            open = index;
+            c.owned = c.tail;
+        }
+        for (Chunk& c : parts) {
+            c.offset = total;
+            uint64_t pairs = c.middle + pairsFor(c.owned);
+            if (!c.continues && !c.uniform()) {
+                pairs += pairsFor(c.head);
+            }
+            total += 2 * pairs;
+        }
+
+        compressed.resize(total);
+        Parallel::forEach(chunks, threads, [&](size_t index) {
+            const Chunk& c = parts[index];
+            uint8_t* out = compressed.data() + c.offset;
+            if (!c.uniform()) {
+                if (!c.continues) {
+                    out = writeRun(out, bytes[c.begin], c.head);
+                }
+                out += 2 * encodeRange(bytes, c.begin + c.head, c.end - c.tail, out);
+            }
+            writeRun(out, bytes[c.end - 1], c.owned);
+        });
+    }
+
+    static void decompressParallel(const std::vector<uint8_t>& data, std::vector<uint8_t>& decompressed,
+                                   size_t chunks, unsigned threads) {
+        ArenaScope scope;
+        size_t pairs = data.size() / 2;
+        ArenaVector<uint64_t> offsets(chunks + 1);
+        Parallel::forEach(chunks, threads, [&](size_t chunk) {
+            uint64_t total = 0;
+            size_t end = Parallel::split(pairs, chunks, chunk + 1);
+            for (size_t i = Parallel::split(pairs, chunks, chunk); i < end; i++) {
+                total += data[2 * i];
+            }
+            offsets[chunk + 1] = total;
+        });
+        for (size_t chunk = 0; chunk < chunks; chunk++) {
+            offsets[chunk + 1] += offsets[chunk];
+        }
+
+        decompressed.resize(offsets[chunks]);
+        Parallel::forEach(chunks, threads, [&](size_t chunk) {
+            uint8_t* out = decompressed.data() + offsets[chunk];
+            size_t end = Parallel::split(pairs, chunks, chunk + 1);
+            for (size_t i = Parallel::split(pairs, chunks, chunk); i < end; i++) {
+                std::memset(out, data[2 * i + 1], data[2 * i]);
+                out += data[2 * i];
+            }
+        });
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,225 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+
+#include "allocation.hpp"
+#include "perf_counters.hpp"
+
+// Per-phase instrumentation. A PhaseTimer around a phase adds its wall
+// time, input bytes and heap allocations (count, bytes, peak growth) to a
+// process-wide table keyed by phase name. Collection is off by default; a
+// disabled timer costs one relaxed load and a branch. Phases may nest, and
+// each reports inclusive time. With counters enabled each phase also
+// accumulates the calling thread's hardware counter deltas (see
+// perf_counters.hpp).
+struct PhaseTotals {
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    uint64_t nanoseconds = 0;
+    uint64_t allocations = 0;
+    uint64_t allocated_bytes = 0;
+    uint64_t peak_live_bytes = 0;  // largest heap growth within one call
+    PerfCounters::Values counters{};
+
+    double mbPerSecond() const { return nanoseconds == 0 ? 0.0 : bytes * 1e3 / nanoseconds; }
+};
+
+class Stats {
+public:
+    static bool enabled() { return state().enabled.load(std::memory_order_relaxed); }
+    static void enable(bool on = true) { state().enabled.store(on, std::memory_order_relaxed); }
+
+    static bool countersEnabled() { return state().counters.load(std::memory_order_relaxed); }
+
+    // Opens this thread's counters and turns counting on if any opened.
+    // Returns false, leaving the rest of the stats working, when none did.
+    static bool enableCounters() {
+        bool available = PerfCounters::local().available();
+        state().counters.store(available, std::memory_order_relaxed);
+        return available;
+    }
+
+    static void record(const char* phase, const PhaseTotals& delta) {
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        PhaseTotals& totals = s.phases[phase];
+        totals.calls += delta.calls;
+        totals.bytes += delta.bytes;
+        totals.nanoseconds += delta.nanoseconds;
+        totals.allocations += delta.allocations;
+        totals.allocated_bytes += delta.allocated_bytes;
+        totals.peak_live_bytes = std::max(totals.peak_live_bytes, delta.peak_live_bytes);
+        for (int event = 0; event < PerfCounters::COUNT; event++) {
+            totals.counters[event] += delta.counters[event];
+        }
+    }
+
+    static std::map<std::string, PhaseTotals> snapshot() {
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        return s.phases;
+    }
+
+    static void reset() {
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.phases.clear();
+    }
+
+    static void printText(std::ostream& out) {
+        out << std::left << std::setw(20) << "phase" << std::right << std::setw(8) << "calls" << std::setw(13)
+            << "bytes" << std::setw(11) << "ms" << std::setw(10) << "MB/s" << std::setw(11) << "allocs"
+            << std::setw(12) << "alloc KiB" << std::setw(11) << "peak KiB" << "\n";
+        bool counted = AllocationCounter::installed();
+        for (const auto& [name, t] : snapshot()) {
+            out << std::left << std::setw(20) << name << std::right << std::setw(8) << t.calls << std::setw(13)
+                << t.bytes << std::fixed << std::setprecision(3) << std::setw(11) << t.nanoseconds / 1e6
+                << std::setprecision(1) << std::setw(10) << t.mbPerSecond();
+            if (counted) {
+                out << std::setw(11) << t.allocations << std::setw(12) << t.allocated_bytes / 1024 << std::setw(11)
+                    << t.peak_live_bytes / 1024;
+            } else {
+                out << std::setw(11) << "-" << std::setw(12) << "-" << std::setw(11) << "-";
+            }
+            out << "\n";
+        }
+        if (countersEnabled()) {
+            printCounters(out);
+        }
+    }
+
+    // Cycles per byte and instructions per cycle, then misses per KiB of
+    // phase input (totals for phases that report no bytes).
+    static void printCounters(std::ostream& out) {
+        const PerfCounters& available = PerfCounters::local();
+        out << "\n" << std::left << std::setw(20) << "phase" << std::right << std::setw(10) << "cycles/B"
+            << std::setw(8) << "IPC";
+        const int misses[] = {PerfCounters::BRANCH_MISSES, PerfCounters::L1D_MISSES, PerfCounters::LLC_MISSES,
+                              PerfCounters::DTLB_MISSES};
+        for (const char* label : {"br-miss/K", "L1d-miss/K", "LLC-miss/K", "dTLB-miss/K"}) {
+            out << std::setw(13) << label;
+        }
+        out << "\n";
+        for (const auto& [name, t] : snapshot()) {
+            const auto& c = t.counters;
+            out << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(2);
+            cell(out, 10, available.has(PerfCounters::CYCLES) && t.bytes > 0,
+                 static_cast<double>(c[PerfCounters::CYCLES]) / std::max<uint64_t>(t.bytes, 1));
+            cell(out, 8, available.has(PerfCounters::CYCLES) && available.has(PerfCounters::INSTRUCTIONS),
+                 static_cast<double>(c[PerfCounters::INSTRUCTIONS]) / std::max<uint64_t>(c[PerfCounters::CYCLES], 1));
+            for (int event : misses) {
+                double kib = t.bytes > 0 ? t.bytes / 1024.0 : 1.0;
+                cell(out, 13, available.has(event), c[event] / kib);
+            }
+            out << "\n";
+        }
+    }
+
+    static void printJson(std::ostream& out) {
+        out << "{\"allocations_counted\": " << (AllocationCounter::installed() ? "true" : "false")
+            << ", \"phases\": [";
+        bool first = true;
+        for (const auto& [name, t] : snapshot()) {
+            out << (first ? "\n" : ",\n") << "  {\"name\": \"" << name << "\", \"calls\": " << t.calls
+                << ", \"bytes\": " << t.bytes << ", \"ns\": " << t.nanoseconds << ", \"mbps\": " << std::fixed
+                << std::setprecision(3) << t.mbPerSecond() << ", \"allocations\": " << t.allocations
+                << ", \"allocated_bytes\": " << t.allocated_bytes << ", \"peak_live_bytes\": " << t.peak_live_bytes;
+            if (countersEnabled()) {
+                out << ", \"counters\": {";
+                const char* separator = "";
+                for (int event = 0; event < PerfCounters::COUNT; event++) {
+                    if (PerfCounters::local().has(event)) {
+                        out << separator << "\"" << PerfCounters::name(event) << "\": " << t.counters[event];
+                        separator = ", ";
+                    }
+                }
+                out << "}";
+            }
+            out << "}";
+            first = false;
+        }
+        out << "\n]}\n";
+    }
+
+private:
+    struct State {
+        std::atomic<bool> enabled{false};
+        std::atomic<bool> counters{false};
+        std::mutex mutex;
+        std::map<std::string, PhaseTotals> phases;
+    };
+
+    static void cell(std::ostream& out, int width, bool known, double value) {
+        if (known) {
+            out << std::setw(width) << value;
+        } else {
+            out << std::setw(width) << "-";
+        }
+    }
+
+    static State& state() {
+        static State s;
+        return s;
+    }
+};
+
+// Scoped timer for one phase. `bytes` is the phase's input size; phases
+// that only learn it as they go (reads) can set it before the scope ends.
+class PhaseTimer {
+public:
+    PhaseTimer(const char* phase, uint64_t bytes = 0) : phase_(Stats::enabled() ? phase : nullptr), bytes_(bytes) {
+        if (phase_) {
+            allocations_.emplace();
+            if (Stats::countersEnabled()) {
+                counters_ = PerfCounters::local().read();
+            }
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~PhaseTimer() {
+        if (!phase_) {
+            return;
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        PerfCounters::Values end_counters{};
+        if (Stats::countersEnabled()) {
+            end_counters = PerfCounters::local().read();
+        }
+        PhaseTotals delta;
+        delta.calls = 1;
+        delta.bytes = bytes_;
+        delta.nanoseconds = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        delta.allocations = allocations_->allocations();
+        delta.allocated_bytes = allocations_->bytes();
+        delta.peak_live_bytes = allocations_->peakBytes();
+        for (int event = 0; event < PerfCounters::COUNT; event++) {
+            delta.counters[event] = end_counters[event] - counters_[event];
+        }
+        Stats::record(phase_, delta);
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    void setBytes(uint64_t bytes) { bytes_ = bytes; }
+
+private:
+    const char* phase_;
+    uint64_t bytes_;
+    std::optional<AllocationScope> allocations_;
+    PerfCounters::Values counters_{};
+    std::chrono::steady_clock::time_point start_;
+};
+
+#endif
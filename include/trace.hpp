@@ -0,0 +1,151 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Timeline recorder that dumps Chrome trace JSON (chrome://tracing or
+// ui.perfetto.dev). Each thread records spans into its own fixed-size ring
+// buffer, so recording takes no lock and never allocates; when a buffer
+// wraps, the oldest spans are dropped. A thread takes the registry lock
+// once, on its first span. Disabled, a span costs one relaxed load and a
+// branch.
+class Trace {
+public:
+    static constexpr size_t BUFFER_EVENTS = 1 << 16;
+
+    struct Event {
+        const char* name;
+        uint64_t start_ns;
+        uint64_t duration_ns;
+        int64_t block;  // -1 when the span is not tied to a block
+        uint64_t bytes;
+    };
+
+    static bool enabled() { return state().enabled.load(std::memory_order_relaxed); }
+    static void enable(bool on = true) { state().enabled.store(on, std::memory_order_relaxed); }
+
+    static uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::steady_clock::now() - state().origin)
+                                         .count());
+    }
+
+    static void record(const Event& event) {
+        ThreadBuffer& buffer = local();
+        uint64_t index = buffer.written.load(std::memory_order_relaxed);
+        buffer.events[index % BUFFER_EVENTS] = event;
+        buffer.written.store(index + 1, std::memory_order_release);
+    }
+
+    // Names the calling thread's row in the viewer.
+    static void setThreadName(const std::string& name) {
+        ThreadBuffer& buffer = local();
+        std::lock_guard<std::mutex> lock(state().mutex);
+        buffer.name = name;
+    }
+
+    // Writes every buffered span. Call once the traced work is done: a
+    // buffer that wraps while it is being written out can tear spans.
+    static void write(std::ostream& out) {
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+        const char* separator = "\n";
+        for (const auto& buffer : s.buffers) {
+            out << separator << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->id
+                << ", \"args\": {\"name\": \"" << buffer->name << "\"}}";
+            separator = ",\n";
+
+            uint64_t written = buffer->written.load(std::memory_order_acquire);
+            uint64_t first = written > BUFFER_EVENTS ? written - BUFFER_EVENTS : 0;
+            for (uint64_t i = first; i < written; i++) {
+                const Event& e = buffer->events[i % BUFFER_EVENTS];
+                out << separator << "  {\"name\": \"" << e.name << "\", \"cat\": \"block\", \"ph\": \"X\", \"pid\": 1"
+                    << ", \"tid\": " << buffer->id << ", \"ts\": " << e.start_ns / 1000 << "."
+                    << pad(e.start_ns % 1000) << ", \"dur\": " << e.duration_ns / 1000 << "."
+                    << pad(e.duration_ns % 1000) << ", \"args\": {";
+                if (e.block >= 0) {
+                    out << "\"block\": " << e.block << ", ";
+                }
+                out << "\"bytes\": " << e.bytes << "}}";
+            }
+        }
+        out << "\n]}\n";
+    }
+
+private:
+    struct ThreadBuffer {
+        std::vector<Event> events = std::vector<Event>(BUFFER_EVENTS);
+        std::atomic<uint64_t> written{0};
+        int id = 0;
+        std::string name;
+    };
+
+    struct State {
+        std::atomic<bool> enabled{false};
+        std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+        std::mutex mutex;
+        std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    };
+
+    static State& state() {
+        static State s;
+        return s;
+    }
+
+    // The registry keeps buffers alive after their threads exit.
+    static ThreadBuffer& local() {
+        thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+            auto created = std::make_shared<ThreadBuffer>();
+            State& s = state();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            created->id = static_cast<int>(s.buffers.size()) + 1;
+            created->name = "thread " + std::to_string(created->id);
+            s.buffers.push_back(created);
+            return created;
+        }();
+        return *buffer;
+    }
+
+    static std::string pad(uint64_t fraction) {
+        std::string digits = std::to_string(fraction);
+        return std::string(3 - digits.size(), '0') + digits;
+    }
+};
+
+// Records one span from construction to destruction.
+class TraceSpan {
+public:
+    TraceSpan(const char* name, int64_t block = -1, uint64_t bytes = 0)
+        : name_(Trace::enabled() ? name : nullptr), block_(block), bytes_(bytes) {
+        if (name_) {
+            start_ = Trace::now();
+        }
+    }
+
+    ~TraceSpan() {
+        if (name_) {
+            Trace::record({name_, start_, Trace::now() - start_, block_, bytes_});
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    void setBytes(uint64_t bytes) { bytes_ = bytes; }
+
+private:
+    const char* name_;
+    int64_t block_;
+    uint64_t bytes_;
+    uint64_t start_ = 0;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/uio.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Minimal io_uring driven straight through io_uring_setup(2) and
+// io_uring_enter(2), without liburing: one submission and one completion
+// ring shared with the kernel, reads and writes at explicit offsets, and
+// optional registered files and buffers. Not thread-safe; one owner
+// submits and reaps. The constructor throws if the kernel has no io_uring
+// or refuses it (seccomp, io_uring_disabled), so callers can fall back.
+class IoUring {
+public:
+    struct Completion {
+        uint64_t tag;
+        int result;  // bytes transferred, or -errno
+    };
+
+#ifdef __linux__
+    explicit IoUring(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd_ = static_cast<int>(syscall(SYS_io_uring_setup, entries, &params));
+        if (fd_ < 0) {
+            throw std::runtime_error(std::string("io_uring_setup: ") + std::strerror(errno));
+        }
+
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        single_mmap_ = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap_) {
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+        sq_ring_ = map(sq_size_, IORING_OFF_SQ_RING);
+        cq_ring_ = single_mmap_ ? sq_ring_ : map(cq_size_, IORING_OFF_CQ_RING);
+        sqes_ = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+
+        uint8_t* sq = static_cast<uint8_t*>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries_ = params.sq_entries;
+
+        uint8_t* cq = static_cast<uint8_t*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    ~IoUring() { unmap(); }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // Lets later requests name `fd` by index 0, which skips the per-request
+    // file lookup. Returns false if the kernel refuses.
+    bool registerFile(int fd) {
+        if (syscall(SYS_io_uring_register, fd_, IORING_REGISTER_FILES, &fd, 1) != 0) {
+            return false;
+        }
+        fixed_fd_ = fd;
+        return true;
+    }
+
+    // Pins the buffers once so fixed reads and writes skip mapping them per
+    // request. Refused when they exceed RLIMIT_MEMLOCK on older kernels.
+    bool registerBuffers(const std::vector<iovec>& buffers) {
+        return syscall(SYS_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers.data(),
+                       static_cast<unsigned>(buffers.size())) == 0;
+    }
+
+    // Queues a read or write; `buffer_index` is the registered buffer
+    // holding `data`, or -1. Returns false when the submission ring is full.
+    bool read(int fd, void* data, unsigned length, uint64_t offset, int buffer_index, uint64_t tag) {
+        return queue(buffer_index < 0 ? IORING_OP_READ : IORING_OP_READ_FIXED, fd, data, length, offset,
+                     buffer_index, tag);
+    }
+
+    bool write(int fd, const void* data, unsigned length, uint64_t offset, int buffer_index, uint64_t tag) {
+        return queue(buffer_index < 0 ? IORING_OP_WRITE : IORING_OP_WRITE_FIXED, fd, const_cast<void*>(data),
+                     length, offset, buffer_index, tag);
+    }
+
+    // Hands everything queued to the kernel without waiting.
+    void submit() {
+        if (pending_ > 0) {
+            enter(0);
+        }
+    }
+
+    // Submits everything queued and blocks until one request completes.
+    Completion wait() {
+        Completion completion;
+        while (!reap(completion)) {
+            enter(1);
+        }
+        return completion;
+    }
+
+private:
+    int fd_ = -1;
+    int fixed_fd_ = -1;
+    bool single_mmap_ = false;
+    size_t sq_size_ = 0;
+    size_t cq_size_ = 0;
+    size_t sqes_size_ = 0;
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned pending_ = 0;  // queued but not yet passed to io_uring_enter
+
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    void* map(size_t size, off_t offset) {
+        void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        if (address == MAP_FAILED) {
+            int error = errno;
+            unmap();
+            throw std::runtime_error(std::string("io_uring mmap: ") + std::strerror(error));
+        }
+        return address;
+    }
+
+    void unmap() {
+        if (sqes_) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ring_ && cq_ring_ != sq_ring_) {
+            munmap(cq_ring_, cq_size_);
+        }
+        if (sq_ring_) {
+            munmap(sq_ring_, sq_size_);
+        }
+        sqes_ = nullptr;
+        sq_ring_ = cq_ring_ = nullptr;
+        if (fd_ >= 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    bool queue(uint8_t opcode, int fd, void* data, unsigned length, uint64_t offset, int buffer_index,
+               uint64_t tag) {
+        unsigned tail = *sq_tail_;
+        if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+            return false;
+        }
+        unsigned index = tail & sq_mask_;
+        io_uring_sqe& sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        if (fd == fixed_fd_) {
+            sqe.fd = 0;
+            sqe.flags = IOSQE_FIXED_FILE;
+        } else {
+            sqe.fd = fd;
+        }
+        sqe.addr = reinterpret_cast<uint64_t>(data);
+        sqe.len = length;
+        sqe.off = offset;
+        if (buffer_index >= 0) {
+            sqe.buf_index = static_cast<uint16_t>(buffer_index);
+        }
+        sqe.user_data = tag;
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        pending_++;
+        return true;
+    }
+
+    void enter(unsigned min_complete) {
+        while (true) {
+            long submitted = syscall(SYS_io_uring_enter, fd_, pending_, min_complete, IORING_ENTER_GETEVENTS,
+                                     nullptr, 0);
+            if (submitted >= 0) {
+                pending_ -= static_cast<unsigned>(submitted);
+                return;
+            }
+            if (errno == EAGAIN || errno == EBUSY) {
+                return;  // completions must be reaped first
+            }
+            if (errno != EINTR) {
+                throw std::runtime_error(std::string("io_uring_enter: ") + std::strerror(errno));
+            }
+        }
+    }
+
+    bool reap(Completion& completion) {
+        unsigned head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+        completion = {cqe.user_data, cqe.res};
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+#else
+    explicit IoUring(unsigned) { throw std::runtime_error("io_uring needs Linux"); }
+    bool registerFile(int) { return false; }
+    bool registerBuffers(const std::vector<iovec>&) { return false; }
+    bool read(int, void*, unsigned, uint64_t, int, uint64_t) { return false; }
+    bool write(int, const void*, unsigned, uint64_t, int, uint64_t) { return false; }
+    void submit() {}
+    Completion wait() { return {0, -ENOSYS}; }
+#endif
+};
+
+#endif
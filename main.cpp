@@ -4,53 +4,147 @@
 #include <string>
 #include <unordered_map>
 #include <memory>
+#include <set>
 #include <functional>
 #include "argparse/argparse.hpp"
 #include "include/rle.hpp"
 #include "include/huffman.hpp"
 #include "include/lzw.hpp"
+#include "include/bwt.hpp"
+#include "include/pipeline.hpp"
+#include "include/analyzer.hpp"
+#include "include/level.hpp"
+#include "include/container.hpp"
+#include "include/numa.hpp"
+#include "include/file_io.hpp"
+#include "include/benchmark.hpp"
+#include "include/stats.hpp"
+#include "include/trace.hpp"
+#include "include/allocation_hook.hpp"
 
-std::vector<uint8_t> readFile(const std::string& filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
-        throw std::runtime_error("Cannot open file: " + filename);
-    }
-    return std::vector<uint8_t>(
-        (std::istreambuf_iterator<char>(file)),
+std::vector<uint8_t> readFile(const std::string& filename, IoMode mode, bool direct = false) {
+    PhaseTimer timer("read");
+    InputFile file(filename, mode, direct);
+    std::vector<uint8_t> data(
+        (std::istreambuf_iterator<char>(file.stream())),
         std::istreambuf_iterator<char>()
     );
+    timer.setBytes(data.size());
+    return data;
+}
+
+// Where the output takes positional writes, preallocates it and writes
+// block-sized pieces from up to `threads` threads at once.
+void writeFile(const std::string& filename, const std::vector<uint8_t>& data, IoMode mode, bool direct = false,
+               unsigned threads = 1) {
+    PhaseTimer timer("write", data.size());
+    OutputFile file(filename, mode, direct);
+    if (PositionalFile* positional = file.positional()) {
+        positional->reserve(0, data.size());
+        size_t parts = std::max<size_t>(1, (data.size() + Container::DEFAULT_BLOCK_SIZE - 1) /
+                                               Container::DEFAULT_BLOCK_SIZE);
+        Parallel::forEach(parts, threads, [&](size_t part) {
+            size_t begin = Parallel::split(data.size(), parts, part);
+            size_t end = Parallel::split(data.size(), parts, part + 1);
+            positional->writeAt(begin, data.data() + begin, end - begin);
+        });
+    } else {
+        file.stream().write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+    file.close();
 }
 
-void writeFile(const std::string& filename, const std::vector<uint8_t>& data) {
-    std::ofstream file(filename, std::ios::binary);
-    if (!file) {
-        throw std::runtime_error("Cannot write to file: " + filename);
+void printBlockSummary(const StreamTotals& totals) {
+    std::cout << "Blocks:";
+    for (const auto& [pipeline, count] : totals.blocks_by_pipeline) {
+        std::cout << " " << pipeline << " x" << count;
     }
-    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    std::cout << "\n";
 }
 
-void writeUint64(std::vector<uint8_t>& data, uint64_t value) {
-    for (int i = 0; i < 8; ++i) {
-        data.push_back(static_cast<uint8_t>(value & 0xFF));
-        value >>= 8;
+// Prints the per-phase table for --stats, and writes the files for
+// --stats-json and --trace.
+void writeReports(const argparse::ArgumentParser& program) {
+    if (program.get<bool>("stats") || program.get<bool>("perf-counters")) {
+        std::cout << "\n";
+        Stats::printText(std::cout);
+    }
+    if (auto json_file = program.present<std::string>("--stats-json")) {
+        std::ofstream out(*json_file);
+        if (!out) {
+            throw std::runtime_error("Cannot write to file: " + *json_file);
+        }
+        Stats::printJson(out);
+    }
+    if (auto trace_file = program.present<std::string>("--trace")) {
+        std::ofstream out(*trace_file);
+        if (!out) {
+            throw std::runtime_error("Cannot write to file: " + *trace_file);
+        }
+        Trace::write(out);
     }
 }
 
-uint64_t readUint64(const std::vector<uint8_t>& data, size_t offset) {
-    uint64_t value = 0;
-    for (int i = 7; i >= 0; --i) {
-        value = (value << 8) | data[offset + i];
+// Rewrites the "-1" ... "-9" shorthands into "--level N". Only tokens in
+// flag position are rewritten: the value after an option that takes one
+// (e.g. "--iterations -1", "-o -3") passes through as it is. Keep the list
+// in step with the arguments declared in main().
+std::vector<std::string> expandLevelFlags(int argc, char* argv[]) {
+    static const std::set<std::string> takes_value = {
+        "-a", "--algorithm", "-l", "--level", "--target", "-t", "--threads", "--numa", "--io", "-i", "--input",
+        "-o", "--output", "--stats-json", "--trace", "--benchmark", "--iterations", "--warmup",
+    };
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i > 0 && arg.size() == 2 && arg[0] == '-' && arg[1] >= '1' && arg[1] <= '9') {
+            args.push_back("--level");
+            args.push_back(arg.substr(1));
+        } else {
+            args.push_back(arg);
+            if (i > 0 && takes_value.count(arg) && i + 1 < argc) {
+                args.push_back(argv[++i]);
+            }
+        }
     }
-    return value;
+    return args;
 }
 
 int main(int argc, char* argv[]) {
     argparse::ArgumentParser program("compress", "1.0");
 
     program.add_argument("-a", "--algorithm")
-        .help("compression algorithm")
-        .default_value(std::string("rle"))
-        .choices("rle", "huffman", "lzw");
+        .help("compression algorithm (rle, huffman, lzw, bwt, auto) or a comma-separated chain such as rle,huffman")
+        .default_value(std::string("rle"));
+
+    program.add_argument("-l", "--level")
+        .help("compression level, 1 (fastest) to 9 (smallest); also -1 ... -9")
+        .default_value(CompressionLevel::DEFAULT)
+        .scan<'i', int>();
+
+    program.add_argument("--target")
+        .help("what -a auto optimizes for when choosing each block's codec (default: from --level)")
+        .choices("speed", "balanced", "ratio");
+
+    program.add_argument("-t", "--threads")
+        .help("codec worker threads; above 1, reading, coding and writing overlap (0 = one per core)")
+        .default_value(1)
+        .scan<'i', int>();
+
+    program.add_argument("--numa")
+        .help("with --threads above 1: off, local (pin workers to cores, node-local buffers) or interleave")
+        .default_value(std::string("off"))
+        .choices("off", "local", "interleave");
+
+    program.add_argument("--io")
+        .help("file I/O: uring (several blocks in flight, falls back to pread), pread, or stream (iostreams)")
+        .default_value(std::string("uring"))
+        .choices("uring", "pread", "stream");
+
+    program.add_argument("--direct")
+        .help("bypass the page cache (O_DIRECT) for input and output; needs --io uring or pread")
+        .default_value(false)
+        .implicit_value(true);
 
     program.add_argument("-d", "--decompress")
         .help("Decompress instead of compress")
@@ -58,15 +152,45 @@ int main(int argc, char* argv[]) {
         .implicit_value(true);
 
     program.add_argument("-i", "--input")
-        .help("input file")
-        .required();
+        .help("input file");
 
     program.add_argument("-o", "--output")
-        .help("output file")
-        .required();
+        .help("output file");
+
+    program.add_argument("--stats")
+        .help("print time, bytes, MB/s and allocations per phase")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--perf-counters")
+        .help("with --stats, also read hardware counters (cycles, instructions, cache and TLB misses) per phase")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--stats-json")
+        .help("write the per-phase stats as JSON to FILE")
+        .metavar("FILE");
+
+    program.add_argument("--trace")
+        .help("record block read/compress/write spans and write them as Chrome trace JSON to FILE")
+        .metavar("FILE");
+
+    program.add_argument("--benchmark")
+        .help("benchmark every algorithm and level on FILE instead of compressing (narrow with -a and -l)")
+        .metavar("FILE");
+
+    program.add_argument("--iterations")
+        .help("timed iterations per --benchmark measurement")
+        .default_value(3)
+        .scan<'i', int>();
+
+    program.add_argument("--warmup")
+        .help("untimed warmup iterations per --benchmark measurement")
+        .default_value(1)
+        .scan<'i', int>();
 
     try {
-        program.parse_args(argc, argv);
+        program.parse_args(expandLevelFlags(argc, argv));
     } catch (const std::runtime_error& err) {
         std::cerr << err.what() << "\n";
         std::cerr << program;
@@ -75,89 +199,132 @@ int main(int argc, char* argv[]) {
 
     std::string algorithm = program.get<std::string>("algorithm");
     bool decompress = program.get<bool>("decompress");
-    std::string input_file = program.get<std::string>("input");
-    std::string output_file = program.get<std::string>("output");
+    if (program.is_used("--trace")) {
+        Trace::enable();
+        Trace::setThreadName("main");
+    }
+    bool perf_counters = program.get<bool>("perf-counters");
+    Stats::enable(program.get<bool>("stats") || program.is_used("--stats-json") || perf_counters);
+    if (perf_counters && !Stats::enableCounters()) {
+        std::cerr << "Warning: hardware counters unavailable, " << PerfCounters::local().error() << "\n";
+    }
 
     try {
-        std::vector<uint8_t> data = readFile(input_file);
-        std::vector<uint8_t> result;
-
-        if (!decompress) {
-            std::cout << "Original size: " << data.size() << " bytes\n";
-
-            if (algorithm == "rle") {
-                result = RLE::compress(data);
-                std::cout << "Using RLE compression.\n";
-            } else if (algorithm == "huffman") {
-                std::cout << "Using Huffman encoding.\n";
-                auto [compressed_data, tree] = Huffman::compress(data);
-
-                std::unordered_map<uint8_t, std::string> codes;
-                std::function<void(std::shared_ptr<HuffmanNode>, std::string)> generateCodes =
-                    [&](std::shared_ptr<HuffmanNode> node, std::string code) {
-                        if (!node) return;
-                        if (!node->left && !node->right) {
-                            codes[node->data] = code.empty() ? "0" : code;
-                            return;
-                        }
-                        generateCodes(node->left, code + "0");
-                        generateCodes(node->right, code + "1");
-                    };
-                generateCodes(tree, "");
-
-                size_t original_bits = 0;
-                for (uint8_t byte : data) {
-                    original_bits += codes[byte].length();
-                }
-
-                auto tree_data = serializeTree(tree);
-                result.clear();
-                writeUint64(result, original_bits);
-                writeUint64(result, tree_data.size());
-
-                result.insert(result.end(), tree_data.begin(), tree_data.end());
-                result.insert(result.end(), compressed_data.begin(), compressed_data.end());
-
-            } else if (algorithm == "lzw") {
-                result = LZW::compress(data);
-                std::cout << "Using LZW compression.\n";
+        if (auto benchmark_file = program.present<std::string>("--benchmark")) {
+            int iterations = program.get<int>("iterations");
+            int warmup = program.get<int>("warmup");
+            if (iterations < 1 || warmup < 0) {
+                throw std::runtime_error("--iterations must be at least 1 and --warmup at least 0");
+            }
+            std::vector<std::string> algorithms = Benchmark::algorithms();
+            if (program.is_used("--algorithm")) {
+                algorithms = {algorithm};
+            }
+            std::vector<int> levels;
+            for (int level = CompressionLevel::MIN; level <= CompressionLevel::MAX; level++) {
+                levels.push_back(level);
+            }
+            if (program.is_used("--level")) {
+                levels = {CompressionLevel::get(program.get<int>("level")).level};
             }
 
-            std::cout << "Compressed size: " << result.size() << " bytes\n";
-            std::cout << "Compression ratio: " <<
-                (data.empty() ? 0.0 : (100.0 * result.size() / data.size())) << "%\n";
+            std::vector<uint8_t> data = readFile(*benchmark_file, IoMode::Stream);
+            std::vector<BenchmarkEntry> entries = Benchmark::run(data, algorithms, levels, iterations, warmup);
+            Benchmark::print(std::cout, entries, data.size());
+            bool ok = std::all_of(entries.begin(), entries.end(), [](const BenchmarkEntry& e) { return e.round_trip; });
+            if (!ok) {
+                throw std::runtime_error("Round trip mismatch");
+            }
+            return 0;
+        }
 
-        } else {
-            std::cout << "Decompressing.\n";
+        auto input = program.present<std::string>("--input");
+        auto output = program.present<std::string>("--output");
+        if (!input || !output) {
+            throw std::runtime_error("-i/--input and -o/--output are required");
+        }
+        std::string input_file = *input;
+        std::string output_file = *output;
+        if (FileIo::sameFile(input_file, output_file)) {
+            throw std::runtime_error("Input and output are the same file: " + input_file);
+        }
 
-            if (algorithm == "rle") {
-                result = RLE::decompress(data);
-            } else if (algorithm == "huffman") {
-                if (data.size() < 16) {
-                    throw std::runtime_error("Invalid Huffman compressed file format");
-                }
+        int threads = program.get<int>("threads");
+        if (threads < 0) {
+            throw std::runtime_error("--threads must be at least 0");
+        }
+        NumaPolicy numa = Numa::parsePolicy(program.get<std::string>("numa"));
+        IoMode io = FileIo::parseMode(program.get<std::string>("io"));
+        bool direct = program.get<bool>("direct");
 
-                uint64_t original_bits = readUint64(data, 0);
-                uint64_t tree_size = readUint64(data, 8);
+        CompressionLevel level = CompressionLevel::get(program.get<int>("level"));
+        if (auto target = program.present<std::string>("--target")) {
+            level.target = CompressionLevel::parseTarget(*target);
+        }
 
-                if (data.size() < 16 + tree_size) {
-                    throw std::runtime_error("Corrupted Huffman compressed file");
-                }
+        if (!decompress) {
+            InputFile in(input_file, io, direct);
+            OutputFile out(output_file, io, direct);
 
-                std::vector<uint8_t> tree_data(data.begin() + 16, data.begin() + 16 + tree_size);
-                auto [tree, _] = deserializeTree(tree_data, 0);
+            StreamTotals totals;
+            if (algorithm == "auto") {
+                std::cout << "Choosing compression per block.\n";
+                totals = Container::compressAdaptive(in.stream(), out.stream(), level, threads, numa,
+                                                     out.positional());
+            } else {
+                Pipeline pipeline(level.configure(Pipeline::parseSpecs(algorithm)));
+                std::cout << "Using " << pipeline.describe() << " compression.\n";
+                totals = Container::compress(in.stream(), out.stream(), pipeline, level.block_size, threads, numa,
+                                             out.positional());
+            }
+            out.close();
 
-                std::vector<uint8_t> compressed_data(data.begin() + 16 + tree_size, data.end());
-                result = Huffman::decompress(compressed_data, tree, original_bits);
+            std::cout << "Original size: " << totals.input_bytes << " bytes\n";
+            std::cout << "Compressed size: " << totals.output_bytes << " bytes\n";
+            std::cout << "Compression ratio: " <<
+                (totals.input_bytes == 0 ? 0.0 : (100.0 * totals.output_bytes / totals.input_bytes)) << "%\n";
+            printBlockSummary(totals);
+            writeReports(program);
+            std::cout << "Operation completed successfully!\n";
+            return 0;
+        }
 
-            } else if (algorithm == "lzw") {
-                result = LZW::decompress(data);
+        std::cout << "Decompressing.\n";
+        {
+            InputFile in(input_file, io, direct);
+            if (Container::hasHeader(in.stream())) {
+                OutputFile out(output_file, io, direct);
+                StreamTotals totals =
+                    Container::decompress(in.stream(), out.stream(), threads, numa, out.positional());
+                out.close();
+                std::cout << "Decompressed size: " << totals.output_bytes << " bytes\n";
+                printBlockSummary(totals);
+                writeReports(program);
+                std::cout << "Operation completed successfully!\n";
+                return 0;
             }
+        }
+
+        // Headerless files from before the container format.
+        std::vector<uint8_t> data = readFile(input_file, io, direct);
+        std::vector<uint8_t> result;
 
-            std::cout << "Decompressed size: " << result.size() << " bytes\n";
+        if (algorithm == "rle") {
+            result = RLE::decompress(data, threads);
+        } else if (algorithm == "huffman") {
+            result = Huffman::decompressFramed(data, threads);
+        } else if (algorithm == "lzw") {
+            result = LZW::decompress(data);
+        } else if (algorithm == "bwt") {
+            result = BWT::decompress(Huffman::decompressFramed(data, threads), threads);
+        } else {
+            throw std::runtime_error("Unknown algorithm for headerless input: " + algorithm);
         }
 
-        writeFile(output_file, result);
+        std::cout << "Decompressed size: " << result.size() << " bytes\n";
+
+        writeFile(output_file, result, io, direct, threads);
+        writeReports(program);
         std::cout << "Operation completed successfully!\n";
 
     } catch (const std::exception& e) {